@@ -1,17 +1,58 @@
 #include "osm.h"
+#include "osm_internal.h"
 #include <sys/time.h>
-
-unsigned int numIters; // 1k default as specified
-int UNROLL_FACTOR = 10;
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define OSM_HAS_TSC 1
+#else
+#define OSM_HAS_TSC 0
+#endif
+
+#define KERNEL_UNROLL 10
 
 const double MILLION = 1000000.0;
 const double THOUSAND = 1000.0;
-const unsigned int  DEFAULT_NUM_ITERS = 1000;
+
+const unsigned int DEFAULT_REPETITIONS = 30;
+const unsigned int DEFAULT_WARMUP = 3;
+const double DEFAULT_OUTLIER_CUTOFF = 3.5;
+const double MAD_TO_STDDEV = 1.4826;    // scales a MAD to a stddev, for normal data
+
+// two-sided 95% Student t quantiles for 1..30 degrees of freedom
+const double T_QUANTILES_95[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+const double Z_QUANTILE_95 = 1.960;
+
+const unsigned int MAX_CALIBRATION_GROWTH = 10;    // per calibration round
+const unsigned int MAX_CALIBRATED_ITERS = 1u << 30;
+
+const unsigned int OVERHEAD_SAMPLES = 1001;   // odd, so the median is a sample
+const long TSC_CALIBRATION_NANO = 20000000;  // 20ms busy wait against the raw clock
+
+osm_clock selectedClock = OSM_CLOCK_MONOTONIC_RAW;
+double tscGhz = 0;          // TSC ticks per nano-second, 0 if no usable TSC
+double ticksPerNano = 1;    // ticks of the selected clock per nano-second
+double overheadTicks = 0;   // cost of a start/stop pair, in ticks of the selected clock
+bool hasRdtscp = false;
 
 // forward declarations
-void setup_iteration_number(unsigned int iterations);
-double getTimeInterval(timeval &timeBefore, timeval &timeAfter);
-void emptyFuncCall();
+double percentile(const std::vector<double> &sorted, double fraction);
+double medianOf(std::vector<double> values);
+void medianCounters(const std::vector<osm_counters> &samples, osm_counters *counters);
+unsigned int calibrateIterations(const measureFunc &measure, double targetNano);
+double calibrateTsc();
+double calibrateOverhead();
+void emptyFuncCall() __attribute__((noinline));
 
 
 /* Initialization function that the user must call
@@ -22,6 +63,42 @@ void emptyFuncCall();
  * Returns 0 uppon success and -1 on failure
  */
 int osm_init(){
+    return osm_init_clock(OSM_CLOCK_MONOTONIC_RAW);
+}
+
+
+/* Same as osm_init(), but selects the clock backing all measurements.
+ * Measures the TSC frequency (where there is one) and the overhead of the
+ * chosen clock, which is subtracted from every measurement.
+ * Returns 0 uppon success and -1 on failure (e.g. no usable TSC)
+ */
+int osm_init_clock(osm_clock clock){
+
+    // the TSC is calibrated for every clock, so cycles can always be reported
+    tscGhz = calibrateTsc();
+
+    switch (clock){
+        case OSM_CLOCK_TSC:
+            if (tscGhz <= 0){
+                return -1;
+            }
+            ticksPerNano = tscGhz;
+            break;
+        case OSM_CLOCK_MONOTONIC_RAW:
+            ticksPerNano = 1;
+            break;
+        case OSM_CLOCK_GETTIMEOFDAY:
+            ticksPerNano = 1 / THOUSAND;
+            break;
+        default:
+            return -1;
+    }
+    selectedClock = clock;
+
+    overheadTicks = calibrateOverhead();
+    if (overheadTicks < 0){
+        return -1;
+    }
     return 0;
 }
 
@@ -33,165 +110,446 @@ int osm_init(){
  * Returns 0 uppon success and -1 on failure
  */
 int osm_finalizer(){
+    memoryFinalize();
+    vmFinalize();
     return 0;
 }
 
 
+/* Returns the clock selected by the last initialization. */
+osm_clock osm_get_clock(){
+    return selectedClock;
+}
+
+
+/* Returns the measured TSC frequency in GHz (TSC ticks per nano-second),
+ * or 0 if there is no usable TSC.
+ */
+double osm_tsc_ghz(){
+    return tscGhz;
+}
+
+
+/* Returns the calibrated cost of one start/stop pair of the selected clock,
+ * in nano-seconds.
+ */
+double osm_timer_overhead(){
+    return overheadTicks / ticksPerNano;
+}
+
+
 /* Time measurement function for a simple arithmetic operation.
    returns time in nano-seconds upon success,
    and -1 upon failure.
    */
 double osm_operation_time(unsigned int iterations){
-
-    setup_iteration_number(iterations);
-
-    // pre-stuff
-    int x0,x1,x2,x3,x4,x5,x6,x7,x8,x9;
-    x0=x1=x2=x3=x4=x5=x6=x7=x8=x9=0; //initialise vars
-
-    // start time
-    timeval timeBefore{}, timeAfter{};
-    if (gettimeofday(&timeBefore, nullptr) != 0){
+    osm_stats_options single{1, 0, 0, 0};
+    osm_stats stats{};
+    if (osm_operation_stats(iterations, &single, &stats) != 0){
         return -1;
     }
+    return stats.mean;
+}
 
-    // loop
-    for (unsigned int i = 0; i < numIters ; i+=UNROLL_FACTOR)
-    {
-        x0 += 1;  //1
-        x1 += 1;  //2
-        x2 += 1;  //3
-        x3 += 1;  //4
-        x4 += 1;  //5
-        x5 += 1;  //6
-        x6 += 1;  //7
-        x7 += 1;  //8
-        x8 += 1;  //9
-        x9 += 1;  //10
 
+/* Time measurement function for an empty function call.
+   returns time in nano-seconds upon success,
+   and -1 upon failure.
+   */
+double osm_function_time(unsigned int iterations){
+    osm_stats_options single{1, 0, 0, 0};
+    osm_stats stats{};
+    if (osm_function_stats(iterations, &single, &stats) != 0){
+        return -1;
     }
+    return stats.mean;
+}
 
-    // end
-    if (gettimeofday(&timeAfter, nullptr) != 0){
+
+/* Time measurement function for an empty trap into the operating system.
+   returns time in nano-seconds upon success,
+   and -1 upon failure.
+   */
+double osm_syscall_time(unsigned int iterations){
+    osm_stats_options single{1, 0, 0, 0};
+    osm_stats stats{};
+    if (osm_syscall_stats(iterations, &single, &stats) != 0){
         return -1;
     }
+    return stats.mean;
+}
 
-    //return the time difference
-    return getTimeInterval(timeBefore, timeAfter);
 
+/* Same as osm_operation_time, reporting nano-seconds and cycles into result.
+   Every unrolled lane adds to its own copy of x, so the additions are independent.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_operation_measure(unsigned int iterations, osm_measurement *result){
+    int x[KERNEL_UNROLL] = {0};
+    return measureUnrolled<KERNEL_UNROLL>([x](unsigned int lane) mutable {
+        x[lane] += 1;
+        doNotOptimize(x[lane]);
+    }, iterations, result);
 }
 
+int osm_operation_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_operation_measure, iterations, options, stats);
+}
 
-/* Time measurement function for an empty function call.
-   returns time in nano-seconds upon success,
-   and -1 upon failure.
+
+/* The kernels below time a single statement each, in the same way: osm_X_measure
+   runs it unrolled KERNEL_UNROLL times per loop, and osm_X_stats repeats that.
+   osm_function_*     -- an empty function call
+   osm_syscall_*      -- an empty trap into the operating system (int 0x80)
+   osm_syscall_instr_* -- an empty trap through the syscall instruction (x86-64 only)
+   osm_getpid_*       -- getpid() through libc
+   osm_getppid_*      -- getppid() through libc
+   osm_vdso_clock_*   -- clock_gettime() served by the vDSO
    */
-double osm_function_time(unsigned int iterations){
+OSM_UNROLLED_KERNEL(function, KERNEL_UNROLL, [](unsigned int) { emptyFuncCall(); })
 
-    setup_iteration_number(iterations);
+OSM_UNROLLED_KERNEL(syscall, KERNEL_UNROLL, [](unsigned int) { OSM_NULLSYSCALL; })
 
-    // start time
-    timeval timeBefore{}, timeAfter{};
-    if (gettimeofday(&timeBefore, nullptr) != 0){
-        return -1;
-    }
+#ifdef __x86_64__
+OSM_UNROLLED_KERNEL(syscall_instr, KERNEL_UNROLL, [](unsigned int) { OSM_NULLSYSCALL64; })
+#else
+int osm_syscall_instr_measure(unsigned int iterations, osm_measurement *result){
+    (void) iterations;
+    (void) result;
+    return -1;
+}
 
-    for (unsigned int i = 0; i < numIters ; i+=UNROLL_FACTOR)
-    {
-        emptyFuncCall(); //1
-        emptyFuncCall(); //2
-        emptyFuncCall(); //3
-        emptyFuncCall(); //4
-        emptyFuncCall(); //5
-        emptyFuncCall(); //6
-        emptyFuncCall(); //7
-        emptyFuncCall(); //8
-        emptyFuncCall(); //9
-        emptyFuncCall(); //10
-    }
+int osm_syscall_instr_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_syscall_instr_measure, iterations, options, stats);
+}
+#endif
 
-    // end
-    if (gettimeofday(&timeAfter, nullptr) != 0){
-        return -1;
+OSM_UNROLLED_KERNEL(getpid, KERNEL_UNROLL, [](unsigned int) { getpid(); })
+
+OSM_UNROLLED_KERNEL(getppid, KERNEL_UNROLL, [](unsigned int) { getppid(); })
+
+OSM_UNROLLED_KERNEL(vdso_clock, KERNEL_UNROLL, [](unsigned int) {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+})
+
+
+/* Finds the iteration count for which one sample of measure lasts at least
+   targetNano nano-seconds: starts from a single iteration and grows by the
+   measured shortfall, at most MAX_CALIBRATION_GROWTH times per round.
+   Returns the count, or 0 upon failure.
+   */
+unsigned int calibrateIterations(const measureFunc &measure, double targetNano){
+    unsigned int iterations = 1;
+    osm_measurement result{};
+    while (iterations < MAX_CALIBRATED_ITERS){
+        if (measure(iterations, &result) != 0){
+            return 0;
+        }
+        // unrolled kernels round the count up, so scale from the iterations that ran
+        iterations = std::max(iterations, result.iterations);
+        double sampleNano = result.nanoseconds * iterations;
+        if (sampleNano >= targetNano){
+            break;
+        }
+        // samples hidden by the timer overhead give no estimate, so grow the most
+        double growth = (sampleNano > 0) ? targetNano / sampleNano : MAX_CALIBRATION_GROWTH;
+        growth = std::min(std::max(growth, 2.0), (double) MAX_CALIBRATION_GROWTH);
+        iterations = (unsigned int) std::min((double) MAX_CALIBRATED_ITERS, std::ceil(iterations * growth));
     }
+    return iterations;
+}
 
-    //return the time difference
-    return getTimeInterval(timeBefore, timeAfter);
 
+#if OSM_HAS_TSC
+/* Reads the TSC after all preceding instructions completed,
+   and before any following instruction starts.
+   */
+inline uint64_t readTscStart(){
+    _mm_lfence();
+    uint64_t ticks = __rdtsc();
+    _mm_lfence();
+    return ticks;
 }
 
+/* Reads the TSC after the measured code completed.
+   rdtscp waits for all preceding instructions, the lfence keeps
+   following instructions from starting early.
+   */
+inline uint64_t readTscStop(){
+    uint64_t ticks;
+    if (hasRdtscp){
+        unsigned int aux;
+        ticks = __rdtscp(&aux);
+    } else {
+        _mm_lfence();
+        ticks = __rdtsc();
+    }
+    _mm_lfence();
+    return ticks;
+}
+#endif
 
-/* Time measurement function for an empty trap into the operating system.
-   returns time in nano-seconds upon success,
-   and -1 upon failure.
+/* Reads the selected clock, in ticks of that clock.
+   Returns 0 upon success, -1 on failure.
    */
-double osm_syscall_time(unsigned int iterations){
+int readClock(uint64_t &ticks, bool isStop){
+    switch (selectedClock){
+#if OSM_HAS_TSC
+        case OSM_CLOCK_TSC:
+            ticks = isStop ? readTscStop() : readTscStart();
+            return 0;
+#endif
+        case OSM_CLOCK_MONOTONIC_RAW: {
+            timespec now{};
+            if (clock_gettime(CLOCK_MONOTONIC_RAW, &now) != 0){
+                return -1;
+            }
+            ticks = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+            return 0;
+        }
+        case OSM_CLOCK_GETTIMEOFDAY: {
+            timeval now{};
+            if (gettimeofday(&now, nullptr) != 0){
+                return -1;
+            }
+            ticks = (uint64_t) now.tv_sec * 1000000ULL + (uint64_t) now.tv_usec;
+            return 0;
+        }
+        default:
+            return -1;
+    }
+}
 
-    setup_iteration_number(iterations);
+/* Reads the clock at the start of a measured region.
+   The performance counters start first, so they see none of their own setup.
+   */
+int clockStart(uint64_t &ticks){
+    countersStart();
+    return readClock(ticks, false);
+}
 
-    // start time
-    timeval timeBefore{}, timeAfter{};
-    if (gettimeofday(&timeBefore, nullptr) != 0){
+/* Reads the clock at the end of a measured region.
+   */
+int clockStop(uint64_t &ticks){
+    int status = readClock(ticks, true);
+    countersStop();
+    return status;
+}
+
+/* Converts a measured interval into the average cost of one of its iterations,
+   after subtracting the overhead of the timer itself.
+   */
+int getMeasurement(uint64_t ticksBefore, uint64_t ticksAfter, unsigned int iterations,
+                   osm_measurement *result){
+    if (result == nullptr || iterations == 0){
         return -1;
     }
-    
-    for (unsigned int i = 0; i < numIters ; i+=UNROLL_FACTOR)
-    {
-        OSM_NULLSYSCALL; //1
-        OSM_NULLSYSCALL; //2
-        OSM_NULLSYSCALL; //3
-        OSM_NULLSYSCALL; //4
-        OSM_NULLSYSCALL; //5
-        OSM_NULLSYSCALL; //6
-        OSM_NULLSYSCALL; //7
-        OSM_NULLSYSCALL; //8
-        OSM_NULLSYSCALL; //9
-        OSM_NULLSYSCALL; //10
-    }
-
-    // end
-    if (gettimeofday(&timeAfter, nullptr) != 0){
-        return -1;
+
+    double totalTicks = (double) (ticksAfter - ticksBefore) - overheadTicks;
+    if (totalTicks < 0){
+        totalTicks = 0;
     }
 
-    //return the time difference
-    return getTimeInterval(timeBefore, timeAfter);
+    double totalNano = totalTicks / ticksPerNano;
 
+    result->nanoseconds = totalNano / (double) iterations;
+    result->cycles = (tscGhz > 0) ? result->nanoseconds * tscGhz : -1;
+    result->iterations = iterations;
+    countersResult(iterations, &result->counters);
+    return 0;
 }
 
-/* rounds the iteration number, if necessary.
-   yields default iterations, if necessary.
+/* Runs warm-up rounds and then the requested repetitions of measure,
+   and summarizes the samples into stats.
+   returns 0 upon success, and -1 upon failure.
    */
-void setup_iteration_number(unsigned int iterations){
+int runStats(measureFunc measure, unsigned int iterations,
+             const osm_stats_options *options, osm_stats *stats){
+    if (stats == nullptr){
+        return -1;
+    }
+
+    osm_stats_options opts{DEFAULT_REPETITIONS, DEFAULT_WARMUP, DEFAULT_OUTLIER_CUTOFF, 0};
+    if (options != nullptr){
+        opts = *options;
+        if (opts.repetitions == 0){
+            opts.repetitions = DEFAULT_REPETITIONS;
+        }
+    }
 
-    numIters = (iterations == 0) ? DEFAULT_NUM_ITERS : iterations;
-    
-    // round up iterations to match unrolling factor
-    while (numIters % UNROLL_FACTOR != 0){
-        numIters ++;
+    if (iterations == 0 && opts.target_ms > 0){
+        iterations = calibrateIterations(measure, opts.target_ms * MILLION);
+        if (iterations == 0){
+            return -1;
+        }
     }
-    
+    stats->iterations = iterations;
+
+    osm_measurement result{};
+    for (unsigned int i = 0; i < opts.warmup; i++){
+        if (measure(iterations, &result) != 0){
+            return -1;
+        }
+    }
+
+    std::vector<double> samples(opts.repetitions);
+    std::vector<double> cycles(opts.repetitions);
+    std::vector<osm_counters> counters(opts.repetitions);
+    for (unsigned int i = 0; i < opts.repetitions; i++){
+        if (measure(iterations, &result) != 0){
+            return -1;
+        }
+        samples[i] = result.nanoseconds;
+        cycles[i] = result.cycles;
+        counters[i] = result.counters;
+    }
+
+    std::sort(samples.begin(), samples.end());
+    std::sort(cycles.begin(), cycles.end());
+    stats->samples = opts.repetitions;
+    stats->min = samples.front();
+    stats->median = percentile(samples, 0.5);
+    stats->p90 = percentile(samples, 0.9);
+    stats->p99 = percentile(samples, 0.99);
+    stats->max = samples.back();
+    stats->median_cycles = (tscGhz > 0) ? percentile(cycles, 0.5) : -1;
+    medianCounters(counters, &stats->counters);
+
+    // reject samples too far above the median (interruptions only ever add time)
+    size_t kept = samples.size();
+    if (opts.outlier_cutoff > 0){
+        std::vector<double> deviations(samples.size());
+        for (size_t i = 0; i < samples.size(); i++){
+            deviations[i] = std::fabs(samples[i] - stats->median);
+        }
+        std::sort(deviations.begin(), deviations.end());
+        double mad = MAD_TO_STDDEV * percentile(deviations, 0.5);
+        if (mad > 0){
+            double limit = stats->median + opts.outlier_cutoff * mad;
+            kept = std::upper_bound(samples.begin(), samples.end(), limit) - samples.begin();
+        }
+    }
+    stats->rejected = (unsigned int) (samples.size() - kept);
+
+    double sum = 0;
+    for (size_t i = 0; i < kept; i++){
+        sum += samples[i];
+    }
+    stats->mean = sum / (double) kept;
+
+    double squares = 0;
+    for (size_t i = 0; i < kept; i++){
+        squares += (samples[i] - stats->mean) * (samples[i] - stats->mean);
+    }
+    stats->stddev = (kept > 1) ? std::sqrt(squares / (double) (kept - 1)) : 0;
+
+    size_t freedom = kept - 1;
+    double quantile = (freedom == 0) ? 0 :
+                      (freedom <= sizeof(T_QUANTILES_95) / sizeof(T_QUANTILES_95[0])) ?
+                      T_QUANTILES_95[freedom - 1] : Z_QUANTILE_95;
+    double halfWidth = quantile * stats->stddev / std::sqrt((double) kept);
+    stats->ci_low = stats->mean - halfWidth;
+    stats->ci_high = stats->mean + halfWidth;
+    return 0;
+}
+
+/* Returns the given fraction of sorted samples, interpolating between ranks.
+   */
+double percentile(const std::vector<double> &sorted, double fraction){
+    double rank = fraction * (double) (sorted.size() - 1);
+    size_t lower = (size_t) rank;
+    if (lower + 1 >= sorted.size()){
+        return sorted.back();
+    }
+    return sorted[lower] + (rank - (double) lower) * (sorted[lower + 1] - sorted[lower]);
 }
 
-/* Returns the time interval
+/* Returns the median of values.
    */
-double getTimeInterval(timeval &timeBefore, timeval &timeAfter){
-    double diffSeconds = timeAfter.tv_sec - timeBefore.tv_sec;
+double medianOf(std::vector<double> values){
+    std::sort(values.begin(), values.end());
+    return percentile(values, 0.5);
+}
 
-    double diffMicroSeconds = timeAfter.tv_usec - timeBefore.tv_usec;
+/* Fills counters with the median of every counter over samples.
+   The result is only valid if every sample had counters.
+   */
+void medianCounters(const std::vector<osm_counters> &samples, osm_counters *counters){
+    *counters = osm_counters{};
+    for (const osm_counters &sample : samples){
+        if (!sample.valid){
+            return;
+        }
+    }
+
+    double osm_counters::*fields[] = {
+            &osm_counters::instructions, &osm_counters::cycles, &osm_counters::ipc,
+            &osm_counters::branch_misses, &osm_counters::l1d_misses,
+            &osm_counters::llc_misses, &osm_counters::dtlb_misses};
+    std::vector<double> values(samples.size());
+    for (auto field : fields){
+        for (size_t i = 0; i < samples.size(); i++){
+            values[i] = samples[i].*field;
+        }
+        counters->*field = medianOf(values);
+    }
+    counters->valid = 1;
+}
 
-    // add both units for total microseconds
-    double totalMicro = (diffSeconds*MILLION) + diffMicroSeconds;
+/* Measures the TSC frequency against CLOCK_MONOTONIC_RAW.
+   Returns the frequency in GHz, or 0 if there is no usable (invariant) TSC.
+   */
+double calibrateTsc(){
+#if OSM_HAS_TSC
+    unsigned int eax, ebx, ecx, edx;
 
-    // convert to nanoseconds, and return
-    double totalNano = THOUSAND * totalMicro;
+    // the TSC must tick at a constant rate, regardless of power states
+    if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) || !(edx & (1u << 8))){
+        return 0;
+    }
+    hasRdtscp = __get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) && (edx & (1u << 27));
 
-    double avgTime = totalNano / (double) numIters;
+    timespec startTime{}, now{};
+    if (clock_gettime(CLOCK_MONOTONIC_RAW, &startTime) != 0){
+        return 0;
+    }
+    uint64_t tscBefore = readTscStart();
+
+    long elapsed;
+    do {
+        if (clock_gettime(CLOCK_MONOTONIC_RAW, &now) != 0){
+            return 0;
+        }
+        elapsed = (now.tv_sec - startTime.tv_sec) * 1000000000L + (now.tv_nsec - startTime.tv_nsec);
+    } while (elapsed < TSC_CALIBRATION_NANO);
+
+    uint64_t tscAfter = readTscStop();
+    return (double) (tscAfter - tscBefore) / (double) elapsed;
+#else
+    return 0;
+#endif
+}
 
-    return avgTime;
+/* Measures the cost of an empty start/stop pair of the selected clock.
+   Returns the median cost in ticks, or -1 on failure.
+   */
+double calibrateOverhead(){
+    std::vector<uint64_t> samples(OVERHEAD_SAMPLES);
+    for (auto &sample : samples){
+        uint64_t ticksBefore, ticksAfter;
+        if (clockStart(ticksBefore) != 0 || clockStop(ticksAfter) != 0){
+            return -1;
+        }
+        sample = ticksAfter - ticksBefore;
+    }
+    std::nth_element(samples.begin(), samples.begin() + samples.size() / 2, samples.end());
+    return (double) samples[samples.size() / 2];
 }
 
 /* Empty Function Call
+   The empty asm keeps an optimizing build from deciding the call has no effect.
    */
 void emptyFuncCall(){
+    asm volatile("");
 }
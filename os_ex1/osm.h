@@ -1,11 +1,224 @@
 #ifndef _OSM_H
 #define _OSM_H
 
+#include <stddef.h>
 
-/* calling a system call that does nothing */
-#define OSM_NULLSYSCALL asm volatile( "int $0x80 " : : \
-        "a" (0xffffffff) /* no such syscall */, "b" (0), "c" (0), "d" (0) /*:\
-        "eax", "ebx", "ecx", "edx"*/)
+
+/* calling a system call that does nothing.
+ * eax receives the error, and older 64 bit kernels zero r8-r11 on this path,
+ * so both are declared for optimizing builds.
+ */
+#ifdef __x86_64__
+#define OSM_NULLSYSCALL do { int osmRet; asm volatile( "int $0x80 " : "=a" (osmRet) : \
+        "0" (0xffffffff) /* no such syscall */, "b" (0), "c" (0), "d" (0) : \
+        "r8", "r9", "r10", "r11", "memory"); } while (0)
+#else
+#define OSM_NULLSYSCALL do { int osmRet; asm volatile( "int $0x80 " : "=a" (osmRet) : \
+        "0" (0xffffffff) /* no such syscall */, "b" (0), "c" (0), "d" (0) : "memory"); } while (0)
+#endif
+
+
+/* calling a system call that does nothing, through the 64 bit syscall instruction */
+#ifdef __x86_64__
+#define OSM_NULLSYSCALL64 do { long osmRet; asm volatile( "syscall" : "=a" (osmRet) : \
+        "0" (-1L) /* no such syscall */ : "rcx", "r11", "memory"); } while (0)
+#endif
+
+
+/* Clock sources that can back the time measurement functions.
+ * OSM_CLOCK_TSC            -- serialized rdtsc/rdtscp (x86 only, needs an invariant TSC)
+ * OSM_CLOCK_MONOTONIC_RAW  -- clock_gettime(CLOCK_MONOTONIC_RAW), the default
+ * OSM_CLOCK_GETTIMEOFDAY   -- gettimeofday(), microsecond resolution
+ */
+enum osm_clock {
+    OSM_CLOCK_TSC,
+    OSM_CLOCK_MONOTONIC_RAW,
+    OSM_CLOCK_GETTIMEOFDAY
+};
+
+
+/* Hardware performance counter deltas per iteration of a measured operation.
+ * valid is 0 when counters are disabled or unavailable (e.g. in containers).
+ * Single events the host does not support are -1, as is ipc without both
+ * instructions and cycles.
+ */
+struct osm_counters {
+    int valid;
+    double instructions;
+    double cycles;
+    double ipc;
+    double branch_misses;
+    double l1d_misses;
+    double llc_misses;
+    double dtlb_misses;
+};
+
+
+/* The average cost of a single iteration of a measured operation,
+ * after the calibrated overhead of the timer itself was subtracted.
+ * cycles are TSC (reference) cycles, and are -1 when no TSC is available.
+ * counters are filled when osm_enable_counters() succeeded.
+ * iterations is the number of iterations the sample actually timed, which unrolled
+ * kernels round up from the requested count.
+ */
+struct osm_measurement {
+    double nanoseconds;
+    double cycles;
+    osm_counters counters;
+    unsigned int iterations;
+};
+
+
+/* Options for the statistical measurement functions.
+ * repetitions    -- number of measured samples (0 for the default of 30)
+ * warmup         -- rounds run and discarded before the first sample
+ * outlier_cutoff -- samples more than this many (scaled) median absolute deviations
+ *                   above the median are excluded from mean, stddev and the confidence
+ *                   interval. 0 disables outlier rejection.
+ * target_ms      -- when iterations is 0, grow the iterations of a sample until one
+ *                   lasts at least this many milli-seconds, and use that count for all
+ *                   samples. 0 keeps the default iterations of every kernel. Kernels
+ *                   whose iterations are pages of memory ignore it.
+ */
+struct osm_stats_options {
+    unsigned int repetitions;
+    unsigned int warmup;
+    double outlier_cutoff;
+    double target_ms;
+};
+
+
+/* Distribution of the per-iteration cost over all repetitions, in nano-seconds.
+ * min, median, p90, p99 and max are taken over all samples, so the tails stay visible.
+ * mean, stddev and the 95% confidence interval of the mean exclude rejected outliers.
+ * median_cycles is -1 when no TSC is available.
+ * counters holds the median of every counter over all samples.
+ * iterations is the iteration count of every sample, 0 for the kernel's default.
+ */
+struct osm_stats {
+    unsigned int samples;
+    unsigned int rejected;
+    double min;
+    double median;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+    double stddev;
+    double ci_low;
+    double ci_high;
+    double median_cycles;
+    osm_counters counters;
+    unsigned int iterations;
+};
+
+
+/* Tests run between each pair of CPUs by the cross-core latency matrix.
+ * OSM_CORE_PINGPONG -- a cache line bounced between two cores by plain stores
+ * OSM_CORE_CAS      -- compare-and-swap round trips on a shared cache line
+ * OSM_CORE_FUTEX    -- futex wake-up round trips between two sleeping threads
+ */
+enum osm_core_test {
+    OSM_CORE_PINGPONG,
+    OSM_CORE_CAS,
+    OSM_CORE_FUTEX
+};
+
+
+/* Kinds of page faults timed by osm_fault_measure.
+ * OSM_FAULT_MINOR -- first write to fresh anonymous memory, in 4 KiB pages
+ * OSM_FAULT_HUGE  -- first write to fresh anonymous memory, backed by transparent
+ *                    huge pages where the kernel allows them (madvise mode or always)
+ * OSM_FAULT_MAJOR -- first read of a file mapping whose pages were dropped from the
+ *                    page cache. The file is created in $TMPDIR or /var/tmp; on tmpfs
+ *                    the pages cannot be dropped and the faults stay minor.
+ */
+enum osm_fault_kind {
+    OSM_FAULT_MINOR,
+    OSM_FAULT_HUGE,
+    OSM_FAULT_MAJOR
+};
+
+
+/* Operations of the I/O path kernels.
+ * OSM_IO_FILE_READ  -- a 64 byte pread of a file on tmpfs (/dev/shm)
+ * OSM_IO_FILE_WRITE -- a 64 byte pwrite of a file on tmpfs (/dev/shm)
+ * OSM_IO_PIPE       -- a one byte round trip through a pair of pipes and an echo thread
+ * OSM_IO_UNIX       -- a one byte round trip over a Unix stream socket and an echo thread
+ * OSM_IO_TCP        -- a one byte round trip over loopback TCP and an echo thread
+ * OSM_IO_WRITEV     -- a one byte writev into a Unix socket, read back by the same thread
+ * OSM_IO_SEND       -- a one byte send into a Unix socket, read back by the same thread
+ * OSM_IO_URING      -- an io_uring no-op, submitted and completed by one io_uring_enter
+ */
+enum osm_io_op {
+    OSM_IO_FILE_READ,
+    OSM_IO_FILE_WRITE,
+    OSM_IO_PIPE,
+    OSM_IO_UNIX,
+    OSM_IO_TCP,
+    OSM_IO_WRITEV,
+    OSM_IO_SEND,
+    OSM_IO_URING
+};
+
+
+/* Operations of the lock and atomic kernels.
+ * OSM_LOCK_FETCH_ADD -- an atomic fetch_add of a shared word
+ * OSM_LOCK_CAS       -- an atomic increment by a compare-and-swap loop
+ * OSM_LOCK_MUTEX     -- pthread_mutex_lock and pthread_mutex_unlock
+ * OSM_LOCK_SPINLOCK  -- acquiring and releasing a test and test-and-set spinlock
+ * OSM_LOCK_SEMAPHORE -- sem_post and sem_wait
+ * OSM_LOCK_CONDVAR   -- a pthread_cond_broadcast round: until every other thread woke up
+ * OSM_LOCK_BARRIER   -- a pthread_barrier_wait round of all threads
+ */
+enum osm_lock_op {
+    OSM_LOCK_FETCH_ADD,
+    OSM_LOCK_CAS,
+    OSM_LOCK_MUTEX,
+    OSM_LOCK_SPINLOCK,
+    OSM_LOCK_SEMAPHORE,
+    OSM_LOCK_CONDVAR,
+    OSM_LOCK_BARRIER
+};
+
+
+/* Streaming kernels of the memory bandwidth measurement.
+ * OSM_STREAM_READ  -- sums every word of the buffer
+ * OSM_STREAM_WRITE -- fills the buffer
+ * OSM_STREAM_COPY  -- copies one half of the buffer onto the other
+ */
+enum osm_stream_op {
+    OSM_STREAM_READ,
+    OSM_STREAM_WRITE,
+    OSM_STREAM_COPY
+};
+
+
+/* A statistical measurement function, such as osm_operation_stats.
+ */
+typedef int (*osm_stats_func)(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+
+/* A registered kernel, as listed by osm_kernels.
+ * syscalls is the number of system calls of one iteration, 0 when not counted.
+ */
+struct osm_kernel {
+    const char *name;
+    osm_stats_func stats;
+    double syscalls;
+};
+
+
+/* Operations of the arithmetic latency and throughput measurements.
+ */
+enum osm_arith_op {
+    OSM_ARITH_INT_ADD,
+    OSM_ARITH_INT_MUL,
+    OSM_ARITH_INT_DIV,
+    OSM_ARITH_FP_ADD,
+    OSM_ARITH_FP_MUL,
+    OSM_ARITH_FP_DIV
+};
 
 
 /* Initialization function that the user must call
@@ -18,6 +231,30 @@
 int osm_init();
 
 
+/* Same as osm_init(), but selects the clock backing all measurements.
+ * Measures the TSC frequency (where there is one) and the overhead of the
+ * chosen clock, which is subtracted from every measurement.
+ * Returns 0 uppon success and -1 on failure (e.g. no usable TSC)
+ */
+int osm_init_clock(osm_clock clock);
+
+
+/* Returns the clock selected by the last initialization. */
+osm_clock osm_get_clock();
+
+
+/* Returns the measured TSC frequency in GHz (TSC ticks per nano-second),
+ * or 0 if there is no usable TSC.
+ */
+double osm_tsc_ghz();
+
+
+/* Returns the calibrated cost of one start/stop pair of the selected clock,
+ * in nano-seconds.
+ */
+double osm_timer_overhead();
+
+
 /* finalizer function that the user must call
  * after running any other library function.
  * The function may, for example, free memory or
@@ -27,13 +264,46 @@ int osm_init();
 int osm_finalizer();
 
 
-/* Time measurement function for a simple arithmetic operation.
+/* Returns the registered kernels (operation, syscall, thread, I/O, ...), in the order
+ * drivers should report them, and their number in count.
+ */
+const osm_kernel *osm_kernels(unsigned int *count);
+
+
+/* Enables (or disables) sampling of hardware performance counters (instructions,
+ * cycles, branch misses, L1D, LLC and dTLB read misses) around every measurement
+ * loop run by the calling thread, through perf_event_open.
+ * Returns 0 if at least one counter is available, -1 otherwise.
+ * Measurements keep working without counters either way.
+ */
+int osm_enable_counters(int enable);
+
+
+/* Time measurement function for a simple arithmetic operation
+   (independent integer additions, i.e. their throughput).
    returns time in nano-seconds upon success,
    and -1 upon failure.
    */
 double osm_operation_time(unsigned int iterations);
 
 
+/* Time measurement functions for 64 bit integer and double precision arithmetic.
+   The latency variants run a dependent chain, each operation waiting for the
+   result of the one before. The throughput variants run independent lanes, so
+   the processor can overlap them. Both stay meaningful in optimizing builds.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_arith_latency_measure(osm_arith_op op, unsigned int iterations, osm_measurement *result);
+
+int osm_arith_latency_stats(osm_arith_op op, unsigned int iterations, const osm_stats_options *options,
+                            osm_stats *stats);
+
+int osm_arith_throughput_measure(osm_arith_op op, unsigned int iterations, osm_measurement *result);
+
+int osm_arith_throughput_stats(osm_arith_op op, unsigned int iterations, const osm_stats_options *options,
+                               osm_stats *stats);
+
+
 /* Time measurement function for an empty function call.
    returns time in nano-seconds upon success,
    and -1 upon failure.
@@ -48,4 +318,248 @@ double osm_function_time(unsigned int iterations);
 double osm_syscall_time(unsigned int iterations);
 
 
+/* Same as the functions above, but report both nano-seconds and cycles
+   per iteration into result.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_operation_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_function_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_syscall_measure(unsigned int iterations, osm_measurement *result);
+
+
+/* Run the measurement functions above repeatedly and fill stats with the
+   distribution of the results. options may be null for the defaults
+   (30 repetitions, 3 warm-up rounds, outlier cutoff of 3.5).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_operation_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_function_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_syscall_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+
+/* Time measurement functions for the modern ways into the kernel:
+   osm_syscall_instr_*  -- the x86-64 syscall instruction on an invalid number
+                           (fails on other architectures)
+   osm_getpid_*         -- getpid() through libc
+   osm_getppid_*        -- getppid() through libc
+   osm_vdso_clock_*     -- clock_gettime(CLOCK_MONOTONIC), served by the vDSO
+   Comparing these to osm_syscall_* shows the cost of the entry path and of
+   mitigations such as KPTI and retpolines on the host.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_syscall_instr_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_syscall_instr_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_getpid_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_getpid_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_getppid_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_getppid_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_vdso_clock_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_vdso_clock_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+
+
+/* Returns the number of CPUs this process may run on, or -1 upon failure.
+   */
+int osm_core_count();
+
+
+/* Fills ids with the first count CPU numbers this process may run on,
+   in the order used by osm_core_matrix.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_ids(int *ids, int count);
+
+
+/* Time measurement function for one round trip of test between a thread
+   pinned to cpuA and a thread pinned to cpuB.
+   The spinning tests fail when cpuA == cpuB.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_pair_measure(osm_core_test test, int cpuA, int cpuB, unsigned int iterations,
+                          osm_measurement *result);
+
+
+/* Fills matrix (count x count, row major) with the round trip time of test,
+   in nano-seconds, between every pair of the first count CPUs of osm_core_ids.
+   Diagonal entries are 0 for the spinning tests.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_matrix(osm_core_test test, unsigned int iterations, double *matrix, int count);
+
+
+
+/* Time measurement function for a dependent load from memory: a randomized
+   pointer chase over a working set of size bytes (e.g. 4 KiB to 1 GiB), so
+   that sweeping the size shows the latency of every cache level and of DRAM.
+   iterations is the number of loads (0 for the default).
+   The working set is kept until the size changes or osm_finalizer is called.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_memory_latency_measure(size_t size, unsigned int iterations, osm_measurement *result);
+
+int osm_memory_latency_stats(size_t size, unsigned int iterations, const osm_stats_options *options,
+                             osm_stats *stats);
+
+
+/* Returns the median latency of a dependent load over a working set of size bytes,
+   in nano-seconds, or -1 upon failure.
+   */
+double osm_memory_latency(size_t size);
+
+
+/* Time measurement function for one pass of op over a buffer of size bytes.
+   passes is the number of passes timed together (0 for the default).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_memory_bandwidth_measure(osm_stream_op op, size_t size, unsigned int passes,
+                                 osm_measurement *result);
+
+
+/* Returns the peak bandwidth of op over a buffer of size bytes in GB/s, or -1
+   upon failure. As in STREAM, a copy counts both the bytes read and written.
+   */
+double osm_memory_bandwidth(osm_stream_op op, size_t size);
+
+
+
+/* Time measurement function for faulting in one 4 KiB page of memory, chosen by kind.
+   Every sample maps fresh memory and touches each of its 4 KiB pages once, so huge
+   page backed memory shows its cost spread over the 4 KiB pages it covers.
+   iterations is the number of pages (0 for the default).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_fault_measure(osm_fault_kind kind, unsigned int iterations, osm_measurement *result);
+
+int osm_fault_stats(osm_fault_kind kind, unsigned int iterations, const osm_stats_options *options,
+                    osm_stats *stats);
+
+
+/* Time measurement function for an mmap and munmap pair of an untouched anonymous
+   mapping of size bytes.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_mmap_measure(size_t size, unsigned int iterations, osm_measurement *result);
+
+int osm_mmap_stats(size_t size, unsigned int iterations, const osm_stats_options *options,
+                   osm_stats *stats);
+
+
+/* Time measurement function for releasing one resident 4 KiB page with
+   madvise(MADV_DONTNEED). With shootdown, another thread of the process spins on
+   another CPU meanwhile, so every release also shoots down that CPU's TLB; this
+   fails on a single CPU.
+   iterations is the number of pages released by one call (0 for the default).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_madvise_measure(int shootdown, unsigned int iterations, osm_measurement *result);
+
+int osm_madvise_stats(int shootdown, unsigned int iterations, const osm_stats_options *options,
+                      osm_stats *stats);
+
+
+
+/* Time measurement function for one operation of op on the I/O path.
+   OSM_IO_URING fails where the kernel or its headers lack io_uring.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_io_measure(osm_io_op op, unsigned int iterations, osm_measurement *result);
+
+int osm_io_stats(osm_io_op op, unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+
+/* Returns the number of system calls one operation of op makes, including those
+   of the echo thread, or -1 for an unknown op.
+   */
+double osm_io_syscalls(osm_io_op op);
+
+
+
+/* Time measurement function for one operation of op, done by threads threads at once
+   on the same object (1 for the uncontended cost). Only the calling thread, one of
+   them, is timed; the others keep contending until it is done.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_lock_measure(osm_lock_op op, unsigned int threads, unsigned int iterations, osm_measurement *result);
+
+int osm_lock_stats(osm_lock_op op, unsigned int threads, unsigned int iterations,
+                   const osm_stats_options *options, osm_stats *stats);
+
+
+/* Sets the number of threads of the contended lock kernels of osm_kernels,
+   0 for one per CPU (at least 2, the default).
+   */
+void osm_set_lock_contenders(unsigned int threads);
+
+
+/* Returns the number of threads of the contended lock kernels of osm_kernels.
+   */
+unsigned int osm_lock_contenders();
+
+
+
+/* Time measurement functions for thread costs:
+   osm_thread_create_*  -- pthread_create and pthread_join of an empty thread
+   osm_thread_switch_*  -- a kernel thread context switch, measured as half a futex
+                           round trip between two threads pinned to the same CPU
+   osm_sigjmp_switch_*  -- a sigsetjmp(env, 1) / siglongjmp pair, which is what a
+                           uthreads context switch costs
+   osm_sigprocmask_*    -- blocking and unblocking SIGVTALRM with sigprocmask, as
+                           uthreads does around its critical sections
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_thread_create_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_thread_create_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_thread_switch_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_thread_switch_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_sigjmp_switch_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_sigjmp_switch_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+int osm_sigprocmask_measure(unsigned int iterations, osm_measurement *result);
+
+int osm_sigprocmask_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats);
+
+
+
+/* The result of running a kernel on several threads at once.
+ * latency     -- median over the threads of their median nano-seconds per iteration
+ * latency_max -- median nano-seconds per iteration of the slowest thread
+ * throughput  -- iterations per second of all threads together
+ */
+struct osm_scaling_result {
+    unsigned int threads;
+    double latency;
+    double latency_max;
+    double throughput;
+};
+
+
+/* Runs kernel on threads threads at once, each with its own statistics, and
+   summarizes them into result. With pinned, the threads are spread over the CPUs of
+   osm_core_ids, wrapping around when there are more threads than CPUs.
+   Threads finishing early leave the rest to run with less contention, and with more
+   threads than CPUs, samples short enough to fit in a time slice hide the sharing
+   (raise iterations to see it).
+   The memory kernels share their buffers and must not be run this way.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_scaling_run(osm_stats_func kernel, unsigned int threads, int pinned, unsigned int iterations,
+                    const osm_stats_options *options, osm_scaling_result *result);
+
+
 #endif
@@ -0,0 +1,120 @@
+#include "osm.h"
+#include "osm_internal.h"
+
+#define CHAIN_UNROLL 10
+#define LANES 8
+
+const unsigned int DEFAULT_OPERATIONS = 1000000;
+
+// operands that leave the values unchanged, so chains neither overflow nor denormalize
+const uint64_t INT_SEED = 0x123456789ULL;
+const uint64_t INT_ADDEND = 1;
+const uint64_t INT_FACTOR = 1;
+const double FP_SEED = 1.5;
+const double FP_ADDEND = 0.0;
+const double FP_FACTOR = 1.0;
+
+
+/* Times a dependent chain of op: every operation needs the result of the one before.
+   The operand is hidden from the optimizer, and every intermediate result is forced,
+   so the chain can be neither folded nor removed.
+   returns 0 upon success, and -1 upon failure.
+   */
+template <typename T, typename Op>
+int measureLatency(Op op, T seed, T operand, unsigned int operations, osm_measurement *result){
+    doNotOptimize(operand);
+    return measureUnrolled<CHAIN_UNROLL>([op, seed, operand](unsigned int) mutable {
+        seed = op(seed, operand);
+        doNotOptimize(seed);
+    }, operations, result, DEFAULT_OPERATIONS);
+}
+
+
+/* Times independent lanes of op, which the processor may overlap.
+   The result is the cost of one operation, when LANES of them are in flight.
+   returns 0 upon success, and -1 upon failure.
+   */
+template <typename T, typename Op>
+int measureThroughput(Op op, T seed, T operand, unsigned int operations, osm_measurement *result){
+    T x[LANES];
+    for (T &lane : x){
+        lane = seed;
+    }
+    doNotOptimize(operand);
+    return measureUnrolled<LANES>([op, x, operand](unsigned int lane) mutable {
+        x[lane] = op(x[lane], operand);
+        doNotOptimize(x[lane]);
+    }, operations, result, DEFAULT_OPERATIONS);
+}
+
+
+/* Runs kernel (measureLatency or measureThroughput) on the operation selected by op.
+   returns 0 upon success, and -1 upon failure.
+   */
+template <template <typename> class Kernel>
+int dispatch(osm_arith_op op, unsigned int operations, osm_measurement *result){
+    switch (op){
+        case OSM_ARITH_INT_ADD:
+            return Kernel<uint64_t>::run([](uint64_t a, uint64_t b) { return a + b; },
+                                         INT_SEED, INT_ADDEND, operations, result);
+        case OSM_ARITH_INT_MUL:
+            return Kernel<uint64_t>::run([](uint64_t a, uint64_t b) { return a * b; },
+                                         INT_SEED, INT_FACTOR, operations, result);
+        case OSM_ARITH_INT_DIV:
+            return Kernel<uint64_t>::run([](uint64_t a, uint64_t b) { return a / b; },
+                                         INT_SEED, INT_FACTOR, operations, result);
+        case OSM_ARITH_FP_ADD:
+            return Kernel<double>::run([](double a, double b) { return a + b; },
+                                       FP_SEED, FP_ADDEND, operations, result);
+        case OSM_ARITH_FP_MUL:
+            return Kernel<double>::run([](double a, double b) { return a * b; },
+                                       FP_SEED, FP_FACTOR, operations, result);
+        case OSM_ARITH_FP_DIV:
+            return Kernel<double>::run([](double a, double b) { return a / b; },
+                                       FP_SEED, FP_FACTOR, operations, result);
+        default:
+            return -1;
+    }
+}
+
+template <typename T>
+struct Latency {
+    template <typename Op>
+    static int run(Op op, T seed, T operand, unsigned int operations, osm_measurement *result){
+        return measureLatency(op, seed, operand, operations, result);
+    }
+};
+
+template <typename T>
+struct Throughput {
+    template <typename Op>
+    static int run(Op op, T seed, T operand, unsigned int operations, osm_measurement *result){
+        return measureThroughput(op, seed, operand, operations, result);
+    }
+};
+
+
+/* Time measurement functions for 64 bit integer and double precision arithmetic.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_arith_latency_measure(osm_arith_op op, unsigned int iterations, osm_measurement *result){
+    return dispatch<Latency>(op, iterations, result);
+}
+
+int osm_arith_latency_stats(osm_arith_op op, unsigned int iterations, const osm_stats_options *options,
+                            osm_stats *stats){
+    return runStats([op](unsigned int operations, osm_measurement *result) {
+        return osm_arith_latency_measure(op, operations, result);
+    }, iterations, options, stats);
+}
+
+int osm_arith_throughput_measure(osm_arith_op op, unsigned int iterations, osm_measurement *result){
+    return dispatch<Throughput>(op, iterations, result);
+}
+
+int osm_arith_throughput_stats(osm_arith_op op, unsigned int iterations, const osm_stats_options *options,
+                               osm_stats *stats){
+    return runStats([op](unsigned int operations, osm_measurement *result) {
+        return osm_arith_throughput_measure(op, operations, result);
+    }, iterations, options, stats);
+}
@@ -0,0 +1,264 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
+#include <vector>
+
+const unsigned int DEFAULT_ROUND_TRIPS = 10000;
+
+/* State shared by the two pinned threads of a single pair measurement.
+   The contended word gets a cache line of its own.
+   */
+struct PairRun {
+    osm_core_test test;
+    unsigned int iterations;
+    alignas(64) std::atomic<uint32_t> word;
+    alignas(64) std::atomic<int> arrived;
+    osm_measurement result;
+    int status;
+};
+
+// forward declarations
+void *initiatorMain(void *arg);
+void *responderMain(void *arg);
+void futexWait(std::atomic<uint32_t> &word, uint32_t value);
+void futexWake(std::atomic<uint32_t> &word);
+
+
+/* Returns the number of CPUs this process may run on, or -1 upon failure.
+   */
+int osm_core_count(){
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        return -1;
+    }
+    return CPU_COUNT(&allowed);
+}
+
+
+/* Fills ids with the first count CPU numbers this process may run on,
+   in the order used by osm_core_matrix.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_ids(int *ids, int count){
+    cpu_set_t allowed;
+    if (ids == nullptr || sched_getaffinity(0, sizeof(allowed), &allowed) != 0){
+        return -1;
+    }
+    int found = 0;
+    for (int cpu = 0; cpu < CPU_SETSIZE && found < count; cpu++){
+        if (CPU_ISSET(cpu, &allowed)){
+            ids[found++] = cpu;
+        }
+    }
+    return (found == count) ? 0 : -1;
+}
+
+
+/* Time measurement function for one round trip of test between a thread
+   pinned to cpuA and a thread pinned to cpuB.
+   The spinning tests fail when cpuA == cpuB.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_pair_measure(osm_core_test test, int cpuA, int cpuB, unsigned int iterations,
+                          osm_measurement *result){
+    if (result == nullptr || (cpuA == cpuB && test != OSM_CORE_FUTEX)){
+        return -1;
+    }
+
+    PairRun run;
+    run.test = test;
+    run.iterations = (iterations == 0) ? DEFAULT_ROUND_TRIPS : iterations;
+    run.word = 0;
+    run.arrived = 0;
+    run.status = -1;
+
+    pthread_t initiator, responder;
+    if (startPinned(responder, cpuB, responderMain, &run) != 0){
+        return -1;
+    }
+    if (startPinned(initiator, cpuA, initiatorMain, &run) != 0){
+        // the responder is already waiting, so play the initiator unpinned and fail
+        initiatorMain(&run);
+        pthread_join(responder, nullptr);
+        return -1;
+    }
+    pthread_join(initiator, nullptr);
+    pthread_join(responder, nullptr);
+
+    if (run.status != 0){
+        return -1;
+    }
+    *result = run.result;
+    return 0;
+}
+
+
+/* Fills matrix (count x count, row major) with the round trip time of test,
+   in nano-seconds, between every pair of the first count CPUs of osm_core_ids.
+   Diagonal entries are 0 for the spinning tests.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_core_matrix(osm_core_test test, unsigned int iterations, double *matrix, int count){
+    if (matrix == nullptr || count <= 0){
+        return -1;
+    }
+    std::vector<int> ids(count);
+    if (osm_core_ids(ids.data(), count) != 0){
+        return -1;
+    }
+
+    for (int row = 0; row < count; row++){
+        for (int col = 0; col < count; col++){
+            if (row == col && test != OSM_CORE_FUTEX){
+                matrix[row * count + col] = 0;
+                continue;
+            }
+            osm_measurement result{};
+            if (osm_core_pair_measure(test, ids[row], ids[col], iterations, &result) != 0){
+                return -1;
+            }
+            matrix[row * count + col] = result.nanoseconds;
+        }
+    }
+    return 0;
+}
+
+
+/* Starts a thread running start(arg), pinned to cpu, or unpinned if cpu is negative.
+   returns 0 upon success, and -1 upon failure.
+   */
+int startPinned(pthread_t &thread, int cpu, void *(*start)(void *), void *arg){
+    pthread_attr_t attr;
+    if (pthread_attr_init(&attr) != 0){
+        return -1;
+    }
+    int status = 0;
+    if (cpu >= 0){
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        status = pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    }
+    if (status == 0){
+        status = pthread_create(&thread, &attr, start, arg);
+    }
+    pthread_attr_destroy(&attr);
+    return (status == 0) ? 0 : -1;
+}
+
+/* Times the round trips, started from this side.
+   */
+void *initiatorMain(void *arg){
+    auto run = (PairRun *) arg;
+    const unsigned int iterations = run->iterations;
+
+    // wait until the responder is in place
+    run->arrived++;
+    while (run->arrived.load() < 2){
+        sched_yield();
+    }
+
+    // the round trips must run even if the clock fails, or the responder never finishes
+    uint64_t ticksBefore, ticksAfter;
+    bool clockFailed = clockStart(ticksBefore) != 0;
+
+    switch (run->test){
+        case OSM_CORE_PINGPONG:
+            for (uint32_t i = 0; i < iterations; i++){
+                run->word.store(2 * i + 1, std::memory_order_release);
+                while (run->word.load(std::memory_order_acquire) != 2 * i + 2){
+                    cpuRelax();
+                }
+            }
+            break;
+        case OSM_CORE_CAS:
+            for (uint32_t i = 0; i < iterations; i++){
+                uint32_t expected = 2 * i;
+                while (run->word.load() != 2 * i ||
+                       !run->word.compare_exchange_weak(expected, 2 * i + 1)){
+                    expected = 2 * i;
+                    cpuRelax();
+                }
+            }
+            while (run->word.load() != 2 * iterations){
+                cpuRelax();
+            }
+            break;
+        case OSM_CORE_FUTEX:
+            for (uint32_t i = 0; i < iterations; i++){
+                run->word.store(1);
+                futexWake(run->word);
+                while (run->word.load() == 1){
+                    futexWait(run->word, 1);
+                }
+            }
+            break;
+    }
+
+    if (clockStop(ticksAfter) != 0 || clockFailed){
+        run->status = -1;
+        return nullptr;
+    }
+    run->status = getMeasurement(ticksBefore, ticksAfter, iterations, &run->result);
+    return nullptr;
+}
+
+/* Answers each round trip of the initiator.
+   */
+void *responderMain(void *arg){
+    auto run = (PairRun *) arg;
+    const unsigned int iterations = run->iterations;
+
+    run->arrived++;
+    while (run->arrived.load() < 2){
+        sched_yield();
+    }
+
+    switch (run->test){
+        case OSM_CORE_PINGPONG:
+            for (uint32_t i = 0; i < iterations; i++){
+                while (run->word.load(std::memory_order_acquire) < 2 * i + 1){
+                    cpuRelax();
+                }
+                run->word.store(2 * i + 2, std::memory_order_release);
+            }
+            break;
+        case OSM_CORE_CAS:
+            for (uint32_t i = 0; i < iterations; i++){
+                uint32_t expected = 2 * i + 1;
+                while (run->word.load() != 2 * i + 1 ||
+                       !run->word.compare_exchange_weak(expected, 2 * i + 2)){
+                    expected = 2 * i + 1;
+                    cpuRelax();
+                }
+            }
+            break;
+        case OSM_CORE_FUTEX:
+            for (uint32_t i = 0; i < iterations; i++){
+                while (run->word.load() == 0){
+                    futexWait(run->word, 0);
+                }
+                run->word.store(0);
+                futexWake(run->word);
+            }
+            break;
+    }
+    return nullptr;
+}
+
+/* Sleeps while word still holds value. */
+void futexWait(std::atomic<uint32_t> &word, uint32_t value){
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAIT_PRIVATE, value,
+            nullptr, nullptr, 0);
+}
+
+/* Wakes a thread sleeping on word. */
+void futexWake(std::atomic<uint32_t> &word){
+    syscall(SYS_futex, reinterpret_cast<uint32_t *>(&word), FUTEX_WAKE_PRIVATE, 1,
+            nullptr, nullptr, 0);
+}
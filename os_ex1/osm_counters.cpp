@@ -0,0 +1,231 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#define NUM_EVENTS 6
+#define NO_FD (-1)
+
+const unsigned int COUNTER_OVERHEAD_SAMPLES = 101;
+
+/* One group of counters, read together with PERF_FORMAT_GROUP.
+   */
+struct GroupReading {
+    uint64_t nr;
+    uint64_t timeEnabled;
+    uint64_t timeRunning;
+    uint64_t values[NUM_EVENTS];
+};
+
+// events are indexed in the order of the osm_counters fields
+int eventFds[NUM_EVENTS] = {NO_FD, NO_FD, NO_FD, NO_FD, NO_FD, NO_FD};
+int groupIndex[NUM_EVENTS];     // position of each event in a group reading, -1 if not opened
+int leaderFd = NO_FD;
+int openedEvents = 0;
+pid_t ownerTid = 0;             // counters only follow the thread that enabled them
+
+GroupReading readingBefore, readingAfter;
+bool readingValid = false;
+double overheadCounts[NUM_EVENTS];
+
+// forward declarations
+int openEvent(uint32_t type, uint64_t config, int groupFd);
+void closeCounters();
+bool isOwner();
+int readGroup(GroupReading &reading);
+double eventDelta(int event);
+void calibrateCounters();
+
+
+/* Enables (or disables) sampling of hardware performance counters around every
+ * measurement loop of the calling thread, through perf_event_open.
+ * Returns 0 if at least one counter is available, -1 otherwise.
+ * Measurements keep working without counters either way.
+ */
+int osm_enable_counters(int enable){
+    closeCounters();
+    if (!enable){
+        return 0;
+    }
+
+    const uint32_t types[NUM_EVENTS] = {
+            PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE, PERF_TYPE_HARDWARE,
+            PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE, PERF_TYPE_HW_CACHE};
+    const uint64_t readMiss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    const uint64_t configs[NUM_EVENTS] = {
+            PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_BRANCH_MISSES,
+            PERF_COUNT_HW_CACHE_L1D | readMiss, PERF_COUNT_HW_CACHE_LL | readMiss,
+            PERF_COUNT_HW_CACHE_DTLB | readMiss};
+
+    // the first event the host supports leads the group, the rest join it
+    for (int event = 0; event < NUM_EVENTS; event++){
+        groupIndex[event] = -1;
+        eventFds[event] = openEvent(types[event], configs[event], leaderFd);
+        if (eventFds[event] == NO_FD){
+            continue;
+        }
+        if (leaderFd == NO_FD){
+            leaderFd = eventFds[event];
+        }
+        groupIndex[event] = openedEvents++;
+    }
+
+    if (leaderFd == NO_FD){
+        return -1;
+    }
+    ownerTid = (pid_t) syscall(SYS_gettid);
+    calibrateCounters();
+    return 0;
+}
+
+
+/* Resets and starts the counters, if the calling thread enabled them. */
+void countersStart(){
+    if (leaderFd == NO_FD || !isOwner()){
+        return;
+    }
+    ioctl(leaderFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+    ioctl(leaderFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    readingValid = readGroup(readingBefore) == 0;
+}
+
+
+/* Stops the counters, if the calling thread enabled them. */
+void countersStop(){
+    if (leaderFd == NO_FD || !isOwner() || !readingValid){
+        return;
+    }
+    readingValid = readGroup(readingAfter) == 0;
+    ioctl(leaderFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+    // the group never got onto the PMU (e.g. all counters taken by another user)
+    if (readingAfter.timeRunning == readingBefore.timeRunning){
+        readingValid = false;
+    }
+}
+
+
+/* Fills counters with the per-iteration deltas of the last start/stop pair.
+ * counters->valid is 0 when there are none.
+ */
+void countersResult(unsigned int iterations, osm_counters *counters){
+    memset(counters, 0, sizeof(*counters));
+    if (leaderFd == NO_FD || !isOwner() || !readingValid || iterations == 0){
+        return;
+    }
+
+    double *fields[NUM_EVENTS] = {
+            &counters->instructions, &counters->cycles, &counters->branch_misses,
+            &counters->l1d_misses, &counters->llc_misses, &counters->dtlb_misses};
+    for (int event = 0; event < NUM_EVENTS; event++){
+        if (groupIndex[event] < 0){
+            *fields[event] = -1;
+            continue;
+        }
+        double delta = eventDelta(event) - overheadCounts[event];
+        *fields[event] = std::max(delta, 0.0) / (double) iterations;
+    }
+    counters->ipc = (counters->cycles > 0 && counters->instructions >= 0) ?
+                    counters->instructions / counters->cycles : -1;
+    counters->valid = 1;
+}
+
+
+/* Opens one disabled counter for the calling thread, in groupFd's group.
+   Falls back to user space only counting, which unprivileged users may still get.
+   Returns the file descriptor, or NO_FD if the event is unavailable.
+   */
+int openEvent(uint32_t type, uint64_t config, int groupFd){
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = (groupFd == NO_FD) ? 1 : 0;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                       PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    long fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+    if (fd < 0){
+        attr.exclude_kernel = 1;
+        fd = syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+    return (fd < 0) ? NO_FD : (int) fd;
+}
+
+/* Closes all counters. */
+void closeCounters(){
+    for (int &fd : eventFds){
+        if (fd != NO_FD){
+            close(fd);
+            fd = NO_FD;
+        }
+    }
+    leaderFd = NO_FD;
+    openedEvents = 0;
+    readingValid = false;
+}
+
+/* Returns true iff the calling thread enabled the counters. */
+bool isOwner(){
+    return (pid_t) syscall(SYS_gettid) == ownerTid;
+}
+
+/* Reads all counters of the group at once.
+   Returns 0 upon success, -1 on failure.
+   */
+int readGroup(GroupReading &reading){
+    ssize_t expected = (ssize_t) (3 + openedEvents) * (ssize_t) sizeof(uint64_t);
+    return (read(leaderFd, &reading, sizeof(reading)) == expected) ? 0 : -1;
+}
+
+/* Returns the change of event between the last two readings, scaled up
+   when the kernel multiplexed the group for part of the time.
+   */
+double eventDelta(int event){
+    int index = groupIndex[event];
+    double delta = (double) (readingAfter.values[index] - readingBefore.values[index]);
+    double enabled = (double) (readingAfter.timeEnabled - readingBefore.timeEnabled);
+    double running = (double) (readingAfter.timeRunning - readingBefore.timeRunning);
+    return (running > 0 && running < enabled) ? delta * enabled / running : delta;
+}
+
+/* Measures the counts of an empty start/stop pair, subtracted from every result.
+   */
+void calibrateCounters(){
+    std::vector<double> samples[NUM_EVENTS];
+    for (int event = 0; event < NUM_EVENTS; event++){
+        overheadCounts[event] = 0;
+    }
+
+    for (unsigned int i = 0; i < COUNTER_OVERHEAD_SAMPLES; i++){
+        uint64_t ticksBefore, ticksAfter;
+        clockStart(ticksBefore);
+        clockStop(ticksAfter);
+        if (!readingValid){
+            continue;
+        }
+        for (int event = 0; event < NUM_EVENTS; event++){
+            if (groupIndex[event] >= 0){
+                samples[event].push_back(eventDelta(event));
+            }
+        }
+    }
+
+    for (int event = 0; event < NUM_EVENTS; event++){
+        std::vector<double> &eventSamples = samples[event];
+        if (eventSamples.empty()){
+            continue;
+        }
+        std::nth_element(eventSamples.begin(), eventSamples.begin() + eventSamples.size() / 2,
+                         eventSamples.end());
+        overheadCounts[event] = eventSamples[eventSamples.size() / 2];
+    }
+}
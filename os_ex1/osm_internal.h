@@ -0,0 +1,165 @@
+#ifndef _OSM_INTERNAL_H
+#define _OSM_INTERNAL_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <functional>
+#include "osm.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*
+ * Helpers shared by the osm translation units. Not part of the library interface.
+ */
+
+/* Reads the selected clock at the start of a measured region.
+ * Returns 0 upon success, -1 on failure.
+ */
+int clockStart(uint64_t &ticks);
+
+/* Reads the selected clock at the end of a measured region.
+ * Returns 0 upon success, -1 on failure.
+ */
+int clockStop(uint64_t &ticks);
+
+/* Converts a measured interval into the average cost of one of its iterations,
+ * after subtracting the overhead of the timer itself.
+ * Returns 0 upon success, -1 on failure.
+ */
+int getMeasurement(uint64_t ticksBefore, uint64_t ticksAfter, unsigned int iterations,
+                   osm_measurement *result);
+
+/* A measurement of a kernel, as done by the osm_*_measure functions.
+ */
+typedef std::function<int(unsigned int iterations, osm_measurement *result)> measureFunc;
+
+/* Runs warm-up rounds and then the requested repetitions of measure,
+ * and summarizes the samples into stats.
+ * Returns 0 upon success, -1 on failure.
+ */
+int runStats(measureFunc measure, unsigned int iterations,
+             const osm_stats_options *options, osm_stats *stats);
+
+/* Resets and starts the performance counters, if the calling thread enabled them.
+ */
+void countersStart();
+
+/* Stops the performance counters, if the calling thread enabled them.
+ */
+void countersStop();
+
+/* Fills counters with the per-iteration deltas of the last start/stop pair.
+ * counters->valid is 0 when there are none.
+ */
+void countersResult(unsigned int iterations, osm_counters *counters);
+
+/* Starts a thread running start(arg), pinned to cpu, or unpinned if cpu is negative.
+ * Returns 0 upon success, -1 on failure.
+ */
+int startPinned(pthread_t &thread, int cpu, void *(*start)(void *), void *arg);
+
+/* Releases the buffers kept by the memory kernels.
+ */
+void memoryFinalize();
+
+/* Releases the file kept by the page fault kernels.
+ */
+void vmFinalize();
+
+/* Forces a scalar value to be computed at this point and assumed unknown afterwards,
+ * so the optimizer can neither delete nor fold the work producing it.
+ * Keeps the value in a register, to add no memory traffic.
+ */
+template <typename T>
+inline void doNotOptimize(T &value){
+    asm volatile("" : "+r" (value));
+}
+
+inline void doNotOptimize(double &value){
+#if defined(__x86_64__) || defined(__i386__)
+    asm volatile("" : "+x" (value));
+#else
+    asm volatile("" : "+m" (value));
+#endif
+}
+
+/* Forces all pending writes to memory to be done at this point.
+ */
+inline void clobberMemory(){
+    asm volatile("" : : : "memory");
+}
+
+/* Default number of iterations of the unrolled kernels.
+ */
+const unsigned int DEFAULT_UNROLLED_ITERS = 1000;
+
+/* Calls body(0) .. body(Unroll - 1) in a row, unrolled at compile time, so a body may
+ * keep per-lane state indexed by its (constant) argument.
+ */
+template <unsigned int Lane, unsigned int Unroll>
+struct Unroller {
+    template <typename Body>
+    static inline __attribute__((always_inline)) void run(Body &body){
+        body(Lane);
+        Unroller<Lane + 1, Unroll>::run(body);
+    }
+};
+
+template <unsigned int Unroll>
+struct Unroller<Unroll, Unroll> {
+    template <typename Body>
+    static inline __attribute__((always_inline)) void run(Body &){
+    }
+};
+
+/* Times iterations calls of body (rounded up to a multiple of Unroll, 0 for the
+ * default), Unroll of them per loop, and reports the cost of one call into result.
+ * Returns 0 upon success, -1 on failure.
+ */
+template <unsigned int Unroll, typename Body>
+int measureUnrolled(Body body, unsigned int iterations, osm_measurement *result,
+                    unsigned int defaultIterations = DEFAULT_UNROLLED_ITERS){
+    static_assert(Unroll > 0, "a kernel needs at least one call per loop");
+    iterations = (iterations == 0) ? defaultIterations : iterations;
+    iterations += (Unroll - iterations % Unroll) % Unroll;
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < iterations; i += Unroll){
+        Unroller<0, Unroll>::run(body);
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+
+    return getMeasurement(ticksBefore, ticksAfter, iterations, result);
+}
+
+/* Defines osm_<name>_measure and osm_<name>_stats for a kernel timing the callable
+ * given last, which takes its lane number, unrolled unroll times.
+ */
+#define OSM_UNROLLED_KERNEL(name, unroll, ...) \
+    int osm_##name##_measure(unsigned int iterations, osm_measurement *result){ \
+        return measureUnrolled<unroll>(__VA_ARGS__, iterations, result); \
+    } \
+    int osm_##name##_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){ \
+        return runStats(osm_##name##_measure, iterations, options, stats); \
+    }
+
+/* Hints the processor that we are in a spin-wait loop.
+ */
+inline void cpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+#endif
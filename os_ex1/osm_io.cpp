@@ -0,0 +1,406 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <atomic>
+
+#if defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define OSM_HAVE_IO_URING
+#endif
+#endif
+
+#define FILE_BLOCK 64
+
+const unsigned int DEFAULT_IO_ITERS = 10000;
+const char *SHM_DIR = "/dev/shm";   // tmpfs, so the file path never waits for a disk
+const unsigned int URING_ENTRIES = 8;
+
+/* The two ends of a round trip: the measuring thread writes to ourOut and reads
+   ourIn, and an echo thread copies every byte from echoIn back to echoOut.
+   */
+struct Channel {
+    int ourIn;
+    int ourOut;
+    int echoIn;
+    int echoOut;
+};
+
+// forward declarations
+int openChannel(osm_io_op op, Channel &channel);
+void closeChannel(Channel &channel);
+void *echoMain(void *arg);
+int openShmFile();
+int measureRoundTrips(osm_io_op op, unsigned int iterations, osm_measurement *result);
+int measureFile(osm_io_op op, unsigned int iterations, osm_measurement *result);
+int measureUring(unsigned int iterations, osm_measurement *result);
+
+
+/* Time measurement function for one operation of op on the I/O path.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_io_measure(osm_io_op op, unsigned int iterations, osm_measurement *result){
+    iterations = (iterations == 0) ? DEFAULT_IO_ITERS : iterations;
+    switch (op){
+        case OSM_IO_FILE_READ:
+        case OSM_IO_FILE_WRITE:
+            return measureFile(op, iterations, result);
+        case OSM_IO_PIPE:
+        case OSM_IO_UNIX:
+        case OSM_IO_TCP:
+        case OSM_IO_WRITEV:
+        case OSM_IO_SEND:
+            return measureRoundTrips(op, iterations, result);
+        case OSM_IO_URING:
+            return measureUring(iterations, result);
+        default:
+            return -1;
+    }
+}
+
+
+int osm_io_stats(osm_io_op op, unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats([op](unsigned int operations, osm_measurement *result) {
+        return osm_io_measure(op, operations, result);
+    }, iterations, options, stats);
+}
+
+
+/* Returns the number of system calls one operation of op makes, counting those of the
+   echo thread, or -1 for an unknown op.
+   */
+double osm_io_syscalls(osm_io_op op){
+    switch (op){
+        case OSM_IO_FILE_READ:
+        case OSM_IO_FILE_WRITE:
+        case OSM_IO_URING:
+            return 1;
+        case OSM_IO_WRITEV:
+        case OSM_IO_SEND:
+            return 2;
+        case OSM_IO_PIPE:
+        case OSM_IO_UNIX:
+        case OSM_IO_TCP:
+            return 4;
+        default:
+            return -1;
+    }
+}
+
+
+/* Times small preads or pwrites of a file on tmpfs.
+   returns 0 upon success, and -1 upon failure.
+   */
+int measureFile(osm_io_op op, unsigned int iterations, osm_measurement *result){
+    int fd = openShmFile();
+    if (fd < 0){
+        return -1;
+    }
+    char block[FILE_BLOCK];
+    memset(block, 1, sizeof(block));
+    if (pwrite(fd, block, sizeof(block), 0) != sizeof(block)){
+        close(fd);
+        return -1;
+    }
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    int status = clockStart(ticksBefore);
+
+    for (unsigned int i = 0; i < iterations && status == 0; i++){
+        ssize_t done = (op == OSM_IO_FILE_READ) ? pread(fd, block, sizeof(block), 0) :
+                                                  pwrite(fd, block, sizeof(block), 0);
+        if (done != sizeof(block)){
+            status = -1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        status = -1;
+    }
+
+    close(fd);
+    if (status != 0){
+        return -1;
+    }
+    return getMeasurement(ticksBefore, ticksAfter, iterations, result);
+}
+
+
+/* Times one byte round trips through a channel of op. For writev and send the byte
+   goes through a Unix socket pair and is read back by this thread, so the two differ
+   only in the call that sends it.
+   returns 0 upon success, and -1 upon failure.
+   */
+int measureRoundTrips(osm_io_op op, unsigned int iterations, osm_measurement *result){
+    Channel channel;
+    if (openChannel(op, channel) != 0){
+        return -1;
+    }
+
+    bool echo = (op == OSM_IO_PIPE || op == OSM_IO_UNIX || op == OSM_IO_TCP);
+    pthread_t echoThread;
+    if (echo && pthread_create(&echoThread, nullptr, echoMain, &channel) != 0){
+        closeChannel(channel);
+        return -1;
+    }
+
+    char byte = 1;
+    struct iovec vector = {&byte, 1};
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    int status = clockStart(ticksBefore);
+
+    for (unsigned int i = 0; i < iterations && status == 0; i++){
+        ssize_t sent;
+        switch (op){
+            case OSM_IO_WRITEV:
+                sent = writev(channel.ourOut, &vector, 1);
+                break;
+            case OSM_IO_SEND:
+                sent = send(channel.ourOut, &byte, 1, 0);
+                break;
+            default:
+                sent = write(channel.ourOut, &byte, 1);
+        }
+        if (sent != 1 || read(channel.ourIn, &byte, 1) != 1){
+            status = -1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        status = -1;
+    }
+
+    if (echo){
+        // the echo thread stops at end of file
+        if (op == OSM_IO_PIPE){
+            close(channel.ourOut);
+            channel.ourOut = -1;
+        } else {
+            shutdown(channel.ourOut, SHUT_WR);
+        }
+        pthread_join(echoThread, nullptr);
+    }
+    closeChannel(channel);
+    if (status != 0){
+        return -1;
+    }
+    return getMeasurement(ticksBefore, ticksAfter, iterations, result);
+}
+
+
+#ifdef OSM_HAVE_IO_URING
+
+/* Times an io_uring no-op: one io_uring_enter submits it and waits for its completion.
+   returns 0 upon success, and -1 if io_uring is unavailable or fails.
+   */
+int measureUring(unsigned int iterations, osm_measurement *result){
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int) syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (fd < 0){
+        return -1;
+    }
+
+    size_t sqSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cqSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    size_t sqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single){
+        sqSize = cqSize = (sqSize > cqSize) ? sqSize : cqSize;
+    }
+
+    char *sq = (char *) mmap(nullptr, sqSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             fd, IORING_OFF_SQ_RING);
+    char *cq = single ? sq : (char *) mmap(nullptr, cqSize, PROT_READ | PROT_WRITE,
+                                           MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+    io_uring_sqe *sqes = (io_uring_sqe *) mmap(nullptr, sqesSize, PROT_READ | PROT_WRITE,
+                                               MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    int status = (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) ? -1 : 0;
+
+    if (status == 0){
+        auto sqTail = (std::atomic<unsigned> *) (sq + params.sq_off.tail);
+        unsigned sqMask = *(unsigned *) (sq + params.sq_off.ring_mask);
+        unsigned *sqArray = (unsigned *) (sq + params.sq_off.array);
+        auto cqHead = (std::atomic<unsigned> *) (cq + params.cq_off.head);
+        auto cqTail = (std::atomic<unsigned> *) (cq + params.cq_off.tail);
+        unsigned cqMask = *(unsigned *) (cq + params.cq_off.ring_mask);
+        io_uring_cqe *cqes = (io_uring_cqe *) (cq + params.cq_off.cqes);
+
+        // start time
+        uint64_t ticksBefore, ticksAfter;
+        status = clockStart(ticksBefore);
+
+        for (unsigned int i = 0; i < iterations && status == 0; i++){
+            unsigned tail = sqTail->load(std::memory_order_relaxed);
+            unsigned index = tail & sqMask;
+            memset(&sqes[index], 0, sizeof(io_uring_sqe));
+            sqes[index].opcode = IORING_OP_NOP;
+            sqArray[index] = index;
+            sqTail->store(tail + 1, std::memory_order_release);
+
+            if (syscall(__NR_io_uring_enter, fd, 1, 1, IORING_ENTER_GETEVENTS, nullptr, 0) != 1){
+                status = -1;
+                break;
+            }
+            unsigned head = cqHead->load(std::memory_order_relaxed);
+            if (head == cqTail->load(std::memory_order_acquire) || cqes[head & cqMask].res != 0){
+                status = -1;
+            }
+            cqHead->store(head + 1, std::memory_order_release);
+        }
+
+        // end
+        if (clockStop(ticksAfter) != 0){
+            status = -1;
+        }
+        if (status == 0){
+            status = getMeasurement(ticksBefore, ticksAfter, iterations, result);
+        }
+    }
+
+    if (sqes != MAP_FAILED){
+        munmap(sqes, sqesSize);
+    }
+    if (!single && cq != MAP_FAILED){
+        munmap(cq, cqSize);
+    }
+    if (sq != MAP_FAILED){
+        munmap(sq, sqSize);
+    }
+    close(fd);
+    return status;
+}
+
+#else
+
+int measureUring(unsigned int iterations, osm_measurement *result){
+    (void) iterations;
+    (void) result;
+    return -1;
+}
+
+#endif
+
+
+/* Opens the channel used by op.
+   returns 0 upon success, and -1 upon failure.
+   */
+int openChannel(osm_io_op op, Channel &channel){
+    channel = Channel{-1, -1, -1, -1};
+    if (op == OSM_IO_PIPE){
+        int there[2], back[2];
+        if (pipe(there) != 0){
+            return -1;
+        }
+        if (pipe(back) != 0){
+            close(there[0]);
+            close(there[1]);
+            return -1;
+        }
+        channel = Channel{back[0], there[1], there[0], back[1]};
+        return 0;
+    }
+
+    if (op != OSM_IO_TCP){
+        int pair[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0){
+            return -1;
+        }
+        if (op == OSM_IO_UNIX){
+            channel = Channel{pair[0], pair[0], pair[1], pair[1]};
+        } else {
+            // writev and send read their own bytes back from the peer
+            channel = Channel{pair[1], pair[0], -1, -1};
+        }
+        return 0;
+    }
+
+    // loopback TCP: listen on an ephemeral port, connect to it, and accept
+    int listener = socket(AF_INET, SOCK_STREAM, 0);
+    if (listener < 0){
+        return -1;
+    }
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    int client = -1, server = -1;
+    if (bind(listener, (sockaddr *) &address, sizeof(address)) == 0 && listen(listener, 1) == 0 &&
+        getsockname(listener, (sockaddr *) &address, &length) == 0){
+        client = socket(AF_INET, SOCK_STREAM, 0);
+        if (client >= 0 && connect(client, (sockaddr *) &address, sizeof(address)) == 0){
+            server = accept(listener, nullptr, nullptr);
+        }
+    }
+    close(listener);
+    if (server < 0){
+        if (client >= 0){
+            close(client);
+        }
+        return -1;
+    }
+    // every byte is its own segment, as in a request/response protocol
+    int one = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    setsockopt(server, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    channel = Channel{client, client, server, server};
+    return 0;
+}
+
+/* Closes every distinct descriptor of channel. */
+void closeChannel(Channel &channel){
+    int fds[] = {channel.ourIn, channel.ourOut, channel.echoIn, channel.echoOut};
+    for (int i = 0; i < 4; i++){
+        bool seen = false;
+        for (int j = 0; j < i; j++){
+            seen |= fds[j] == fds[i];
+        }
+        if (fds[i] >= 0 && !seen){
+            close(fds[i]);
+        }
+    }
+    channel = Channel{-1, -1, -1, -1};
+}
+
+/* Copies every byte back until end of file. */
+void *echoMain(void *arg){
+    auto channel = (Channel *) arg;
+    char byte;
+    while (read(channel->echoIn, &byte, 1) == 1){
+        if (write(channel->echoOut, &byte, 1) != 1){
+            break;
+        }
+    }
+    return nullptr;
+}
+
+/* Opens a fresh, already unlinked file on tmpfs.
+   Returns the file descriptor, or -1 upon failure.
+   */
+int openShmFile(){
+    char name[64];
+    snprintf(name, sizeof(name), "%s/osm_io_XXXXXX", SHM_DIR);
+    int fd = mkstemp(name);
+    if (fd >= 0){
+        unlink(name);
+    }
+    return fd;
+}
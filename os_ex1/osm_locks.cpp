@@ -0,0 +1,317 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+const unsigned int DEFAULT_LOCK_ITERS = 100000;
+const unsigned int MIN_CONTENDERS = 2;
+
+unsigned int contenders = 0;    // threads of the contended kernels, 0 for one per CPU
+
+/* State shared by the threads of a single lock measurement.
+   Every contended word gets a cache line of its own.
+   */
+struct LockRun {
+    osm_lock_op op;
+    unsigned int iterations;
+    unsigned int waiters;
+    alignas(64) std::atomic<uint64_t> word;
+    alignas(64) std::atomic<bool> spin;
+    alignas(64) std::atomic<unsigned int> ready;
+    std::atomic<int> go;        // 1 once all threads started, -1 if some could not
+    std::atomic<bool> done;
+    pthread_mutex_t mutex;
+    pthread_cond_t wakeUp;
+    pthread_cond_t acked;
+    uint64_t generation;    // guarded by mutex
+    unsigned int acks;      // guarded by mutex
+    sem_t semaphore;
+    pthread_barrier_t barrier;
+};
+
+// forward declarations
+int initRun(LockRun &run, osm_lock_op op, unsigned int threads, unsigned int iterations);
+void destroyRun(LockRun &run);
+template <osm_lock_op Op> void lockOp(LockRun &run);
+int contendOnce(LockRun &run);
+void broadcastRound(LockRun &run);
+void *contenderMain(void *arg);
+
+
+/* Time measurement function for one operation of op, done by threads threads at once
+   on the same object (1 for the uncontended cost). The calling thread is one of them,
+   and the only one timed.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_lock_measure(osm_lock_op op, unsigned int threads, unsigned int iterations, osm_measurement *result){
+    if (threads == 0 || op < OSM_LOCK_FETCH_ADD || op > OSM_LOCK_BARRIER){
+        return -1;
+    }
+    iterations = (iterations == 0) ? DEFAULT_LOCK_ITERS : iterations;
+
+    LockRun run;
+    if (initRun(run, op, threads, iterations) != 0){
+        return -1;
+    }
+
+    std::vector<pthread_t> others(threads - 1);
+    unsigned int started = 0;
+    for (; started < others.size(); started++){
+        if (startPinned(others[started], -1, contenderMain, &run) != 0){
+            break;
+        }
+    }
+    int status = (started == others.size()) ? 0 : -1;
+    while (run.ready.load() < started){
+        sched_yield();
+    }
+    run.go = (status == 0) ? 1 : -1;
+
+    if (status == 0){
+        switch (op){
+            case OSM_LOCK_FETCH_ADD:
+                status = measureUnrolled<1>([&run](unsigned int) { lockOp<OSM_LOCK_FETCH_ADD>(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_CAS:
+                status = measureUnrolled<1>([&run](unsigned int) { lockOp<OSM_LOCK_CAS>(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_MUTEX:
+                status = measureUnrolled<1>([&run](unsigned int) { lockOp<OSM_LOCK_MUTEX>(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_SPINLOCK:
+                status = measureUnrolled<1>([&run](unsigned int) { lockOp<OSM_LOCK_SPINLOCK>(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_SEMAPHORE:
+                status = measureUnrolled<1>([&run](unsigned int) { lockOp<OSM_LOCK_SEMAPHORE>(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_CONDVAR:
+                status = measureUnrolled<1>([&run](unsigned int) { broadcastRound(run); },
+                                            iterations, result);
+                break;
+            case OSM_LOCK_BARRIER: {
+                unsigned int waited = 0;
+                status = measureUnrolled<1>([&run, &waited](unsigned int) {
+                    pthread_barrier_wait(&run.barrier);
+                    waited++;
+                }, iterations, result);
+                // a failed clock leaves the contenders short of their waits, so finish the rounds for them
+                for (; waited < iterations; waited++){
+                    pthread_barrier_wait(&run.barrier);
+                }
+                break;
+            }
+        }
+    }
+
+    run.done = true;
+    pthread_mutex_lock(&run.mutex);
+    pthread_cond_broadcast(&run.wakeUp);
+    pthread_mutex_unlock(&run.mutex);
+    for (unsigned int i = 0; i < started; i++){
+        pthread_join(others[i], nullptr);
+    }
+    destroyRun(run);
+    return status;
+}
+
+
+int osm_lock_stats(osm_lock_op op, unsigned int threads, unsigned int iterations,
+                   const osm_stats_options *options, osm_stats *stats){
+    return runStats([op, threads](unsigned int operations, osm_measurement *result) {
+        return osm_lock_measure(op, threads, operations, result);
+    }, iterations, options, stats);
+}
+
+
+/* Sets the number of threads of the contended kernels of osm_kernels,
+   0 for one per CPU (at least 2).
+   */
+void osm_set_lock_contenders(unsigned int threads){
+    contenders = threads;
+}
+
+
+/* Returns the number of threads of the contended kernels of osm_kernels.
+   */
+unsigned int osm_lock_contenders(){
+    if (contenders != 0){
+        return contenders;
+    }
+    int cpus = osm_core_count();
+    return std::max(MIN_CONTENDERS, (unsigned int) std::max(cpus, 0));
+}
+
+
+/* Initializes run for threads threads doing iterations operations of op.
+   returns 0 upon success, and -1 upon failure.
+   */
+int initRun(LockRun &run, osm_lock_op op, unsigned int threads, unsigned int iterations){
+    run.op = op;
+    run.iterations = iterations;
+    run.waiters = threads - 1;
+    run.word = 0;
+    run.spin = false;
+    run.ready = 0;
+    run.go = 0;
+    run.done = false;
+    run.generation = 0;
+    run.acks = 0;
+    if (pthread_mutex_init(&run.mutex, nullptr) != 0){
+        return -1;
+    }
+    if (pthread_cond_init(&run.wakeUp, nullptr) == 0){
+        if (pthread_cond_init(&run.acked, nullptr) == 0){
+            if (sem_init(&run.semaphore, 0, 0) == 0){
+                if (pthread_barrier_init(&run.barrier, nullptr, threads) == 0){
+                    return 0;
+                }
+                sem_destroy(&run.semaphore);
+            }
+            pthread_cond_destroy(&run.acked);
+        }
+        pthread_cond_destroy(&run.wakeUp);
+    }
+    pthread_mutex_destroy(&run.mutex);
+    return -1;
+}
+
+/* Releases everything initRun initialized. */
+void destroyRun(LockRun &run){
+    pthread_barrier_destroy(&run.barrier);
+    sem_destroy(&run.semaphore);
+    pthread_cond_destroy(&run.acked);
+    pthread_cond_destroy(&run.wakeUp);
+    pthread_mutex_destroy(&run.mutex);
+}
+
+/* One operation of the kernels every thread runs alike, resolved at compile time.
+   The lock kernels increment the shared word inside their critical section.
+   */
+template <osm_lock_op Op>
+inline void lockOp(LockRun &run){
+    switch (Op){
+        case OSM_LOCK_FETCH_ADD:
+            run.word.fetch_add(1);
+            break;
+        case OSM_LOCK_CAS: {
+            uint64_t seen = run.word.load(std::memory_order_relaxed);
+            while (!run.word.compare_exchange_weak(seen, seen + 1)){
+            }
+            break;
+        }
+        case OSM_LOCK_MUTEX:
+            pthread_mutex_lock(&run.mutex);
+            run.word.store(run.word.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            pthread_mutex_unlock(&run.mutex);
+            break;
+        case OSM_LOCK_SPINLOCK:
+            // test and test-and-set, so waiters spin on their own copy of the line
+            while (run.spin.exchange(true, std::memory_order_acquire)){
+                while (run.spin.load(std::memory_order_relaxed)){
+                    cpuRelax();
+                }
+            }
+            run.word.store(run.word.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            run.spin.store(false, std::memory_order_release);
+            break;
+        case OSM_LOCK_SEMAPHORE:
+            // every thread posts before it waits, so no wait can block for good
+            sem_post(&run.semaphore);
+            while (sem_wait(&run.semaphore) != 0){
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+/* Runs one operation of run's op, for the contending threads.
+   Returns 0 while there are more to run, -1 once they are done.
+   */
+int contendOnce(LockRun &run){
+    switch (run.op){
+        case OSM_LOCK_FETCH_ADD:
+            lockOp<OSM_LOCK_FETCH_ADD>(run);
+            break;
+        case OSM_LOCK_CAS:
+            lockOp<OSM_LOCK_CAS>(run);
+            break;
+        case OSM_LOCK_MUTEX:
+            lockOp<OSM_LOCK_MUTEX>(run);
+            break;
+        case OSM_LOCK_SPINLOCK:
+            lockOp<OSM_LOCK_SPINLOCK>(run);
+            break;
+        case OSM_LOCK_SEMAPHORE:
+            lockOp<OSM_LOCK_SEMAPHORE>(run);
+            break;
+        default:
+            return -1;
+    }
+    return run.done.load(std::memory_order_relaxed) ? -1 : 0;
+}
+
+/* Wakes all waiters with a broadcast, and waits until every one of them woke up.
+   */
+void broadcastRound(LockRun &run){
+    pthread_mutex_lock(&run.mutex);
+    run.generation++;
+    run.acks = 0;
+    pthread_cond_broadcast(&run.wakeUp);
+    while (run.acks < run.waiters){
+        pthread_cond_wait(&run.acked, &run.mutex);
+    }
+    pthread_mutex_unlock(&run.mutex);
+}
+
+/* Body of the threads contending with the timed one. */
+void *contenderMain(void *arg){
+    auto run = (LockRun *) arg;
+    run->ready++;
+    while (run->go.load() == 0){
+        sched_yield();
+    }
+    // a failed start leaves the barrier short of threads, so nobody may wait on it
+    if (run->go.load() < 0){
+        return nullptr;
+    }
+
+    switch (run->op){
+        case OSM_LOCK_CONDVAR: {
+            // every round from the first on is acknowledged, even one that began before this thread got here
+            uint64_t seen = 0;
+            pthread_mutex_lock(&run->mutex);
+            while (true){
+                while (run->generation == seen && !run->done.load()){
+                    pthread_cond_wait(&run->wakeUp, &run->mutex);
+                }
+                if (run->done.load()){
+                    break;
+                }
+                seen = run->generation;
+                run->acks++;
+                pthread_cond_signal(&run->acked);
+            }
+            pthread_mutex_unlock(&run->mutex);
+            break;
+        }
+        case OSM_LOCK_BARRIER:
+            for (unsigned int i = 0; i < run->iterations; i++){
+                pthread_barrier_wait(&run->barrier);
+            }
+            break;
+        default:
+            while (contendOnce(*run) == 0){
+            }
+    }
+    return nullptr;
+}
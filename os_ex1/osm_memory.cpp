@@ -0,0 +1,226 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <sys/mman.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+#define CACHE_LINE 64
+#define UNROLL 10
+
+const unsigned int DEFAULT_LOADS = 1000000;
+const size_t STREAM_BYTES_PER_SAMPLE = 64 * 1024 * 1024;   // default passes stream this much
+const unsigned int CHASE_SEED = 2018;   // fixed, so runs chase the same permutation
+
+/* An anonymous mapping used by the memory kernels.
+   */
+struct Buffer {
+    char *data;
+    size_t size;
+};
+
+Buffer chaseBuffer{nullptr, 0};
+Buffer streamBuffer{nullptr, 0};
+
+// consumed results of the kernels, so they cannot be optimized away
+void *volatile chaseSink;
+volatile uint64_t streamSink;
+
+// forward declarations
+int ensureBuffer(Buffer &buffer, size_t size);
+void releaseBuffer(Buffer &buffer);
+int buildChase(size_t size);
+size_t streamBytes(osm_stream_op op, size_t size);
+
+
+/* Time measurement function for a dependent load from memory: a randomized
+   pointer chase over a working set of size bytes.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_memory_latency_measure(size_t size, unsigned int iterations, osm_measurement *result){
+    if (buildChase(size) != 0){
+        return -1;
+    }
+
+    void **p = (void **) chaseBuffer.data;
+    int status = measureUnrolled<UNROLL>([&p](unsigned int) {
+        p = (void **) *p;
+    }, iterations, result, DEFAULT_LOADS);
+    chaseSink = p;
+    return status;
+}
+
+
+int osm_memory_latency_stats(size_t size, unsigned int iterations, const osm_stats_options *options,
+                             osm_stats *stats){
+    return runStats([size](unsigned int loads, osm_measurement *result) {
+        return osm_memory_latency_measure(size, loads, result);
+    }, iterations, options, stats);
+}
+
+
+/* Returns the median latency of a dependent load over a working set of size bytes,
+   in nano-seconds, or -1 upon failure.
+   */
+double osm_memory_latency(size_t size){
+    osm_stats stats{};
+    if (osm_memory_latency_stats(size, 0, nullptr, &stats) != 0){
+        return -1;
+    }
+    return stats.median;
+}
+
+
+/* Time measurement function for one pass of op over a buffer of size bytes.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_memory_bandwidth_measure(osm_stream_op op, size_t size, unsigned int passes,
+                                 osm_measurement *result){
+    size = size - size % (2 * CACHE_LINE);
+    if (size == 0 || ensureBuffer(streamBuffer, size) != 0){
+        return -1;
+    }
+    if (passes == 0){
+        passes = (unsigned int) std::max((size_t) 1, STREAM_BYTES_PER_SAMPLE / size);
+    }
+
+    const uint64_t *words = (const uint64_t *) streamBuffer.data;
+    const size_t numWords = size / sizeof(uint64_t);
+    char *half = streamBuffer.data + size / 2;
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (unsigned int pass = 0; pass < passes; pass++){
+        switch (op){
+            case OSM_STREAM_READ:
+                // independent sums, so the loads are not serialized
+                for (size_t i = 0; i < numWords; i += 4){
+                    s0 += words[i];
+                    s1 += words[i + 1];
+                    s2 += words[i + 2];
+                    s3 += words[i + 3];
+                }
+                break;
+            case OSM_STREAM_WRITE:
+                memset(streamBuffer.data, (int) pass, size);
+                break;
+            case OSM_STREAM_COPY:
+                memcpy(half, streamBuffer.data, size / 2);
+                break;
+            default:
+                return -1;
+        }
+        // every pass must really write, even though nobody reads the buffer
+        clobberMemory();
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+    streamSink = s0 + s1 + s2 + s3;
+
+    return getMeasurement(ticksBefore, ticksAfter, passes, result);
+}
+
+
+/* Returns the peak bandwidth of op over a buffer of size bytes in GB/s, or -1
+   upon failure. As in STREAM, a copy counts both the bytes read and written.
+   */
+double osm_memory_bandwidth(osm_stream_op op, size_t size){
+    osm_stats stats{};
+    int status = runStats([op, size](unsigned int passes, osm_measurement *result) {
+        return osm_memory_bandwidth_measure(op, size, passes, result);
+    }, 0, nullptr, &stats);
+    if (status != 0 || stats.min <= 0){
+        return -1;
+    }
+    // bytes per nano-second are GB/s
+    return (double) streamBytes(op, size) / stats.min;
+}
+
+
+/* Releases the buffers kept by the memory kernels.
+   */
+void memoryFinalize(){
+    releaseBuffer(chaseBuffer);
+    releaseBuffer(streamBuffer);
+}
+
+
+/* Maps buffer with exactly size bytes, all of them already faulted in.
+   Keeps the current mapping if it has that size.
+   returns 0 upon success, and -1 upon failure.
+   */
+int ensureBuffer(Buffer &buffer, size_t size){
+    if (buffer.data != nullptr && buffer.size == size){
+        return 0;
+    }
+    releaseBuffer(buffer);
+
+    void *data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED){
+        return -1;
+    }
+    memset(data, 1, size);
+    buffer.data = (char *) data;
+    buffer.size = size;
+    return 0;
+}
+
+/* Unmaps buffer, if it is mapped. */
+void releaseBuffer(Buffer &buffer){
+    if (buffer.data != nullptr){
+        munmap(buffer.data, buffer.size);
+    }
+    buffer.data = nullptr;
+    buffer.size = 0;
+}
+
+/* Links every cache line of a size bytes working set into a single random cycle
+   (Sattolo's algorithm), so neither the prefetchers nor the order of the lines help.
+   Keeps the current chase if it has that size.
+   returns 0 upon success, and -1 upon failure.
+   */
+int buildChase(size_t size){
+    size = size - size % CACHE_LINE;
+    size_t lines = size / CACHE_LINE;
+    if (lines < 2 || lines > UINT32_MAX){
+        return -1;
+    }
+    if (chaseBuffer.data != nullptr && chaseBuffer.size == size){
+        return 0;
+    }
+    if (ensureBuffer(chaseBuffer, size) != 0){
+        return -1;
+    }
+
+    std::vector<uint32_t> next(lines);
+    for (size_t i = 0; i < lines; i++){
+        next[i] = (uint32_t) i;
+    }
+    std::mt19937_64 random(CHASE_SEED);
+    for (size_t i = lines - 1; i > 0; i--){
+        std::uniform_int_distribution<size_t> pick(0, i - 1);
+        std::swap(next[i], next[pick(random)]);
+    }
+
+    for (size_t i = 0; i < lines; i++){
+        *(void **) (chaseBuffer.data + i * CACHE_LINE) = chaseBuffer.data + next[i] * CACHE_LINE;
+    }
+    return 0;
+}
+
+/* Returns the bytes moved by one pass of op over size bytes.
+   A copy reads one half of the buffer and writes the other, so every op moves size bytes.
+   */
+size_t streamBytes(osm_stream_op op, size_t size){
+    (void) op;
+    return size - size % (2 * CACHE_LINE);
+}
@@ -0,0 +1,102 @@
+#include "osm.h"
+
+/*
+ * The kernels known to drivers such as stopwatch, in the order they are reported.
+ * A kernel defined with OSM_UNROLLED_KERNEL (or by hand) is registered by adding
+ * its line here.
+ */
+
+// stats function of an arithmetic operation, in its latency or throughput variant
+#define ARITH_KERNEL(variant, op) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_arith_##variant##_stats(op, iterations, options, stats); \
+    }
+
+#define FAULT_KERNEL(kind) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_fault_stats(kind, iterations, options, stats); \
+    }
+
+#define MMAP_KERNEL(size) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_mmap_stats(size, iterations, options, stats); \
+    }
+
+#define MADVISE_KERNEL(shootdown) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_madvise_stats(shootdown, iterations, options, stats); \
+    }
+
+#define IO_KERNEL(op) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_io_stats(op, iterations, options, stats); \
+    }, osm_io_syscalls(op)
+
+#define LOCK_KERNEL(op, threads) \
+    [](unsigned int iterations, const osm_stats_options *options, osm_stats *stats) { \
+        return osm_lock_stats(op, threads, iterations, options, stats); \
+    }
+
+const osm_kernel KERNEL_REGISTRY[] = {
+        {"operation",     osm_operation_stats, 0},
+        {"function",      osm_function_stats, 0},
+        {"syscall",       osm_syscall_stats, 0},
+        {"syscall_instr", osm_syscall_instr_stats, 0},
+        {"getpid",        osm_getpid_stats, 0},
+        {"getppid",       osm_getppid_stats, 0},
+        {"vdso_clock",    osm_vdso_clock_stats, 0},
+        {"thread_create", osm_thread_create_stats, 0},
+        {"thread_switch", osm_thread_switch_stats, 0},
+        {"sigjmp_switch", osm_sigjmp_switch_stats, 0},
+        {"sigprocmask",   osm_sigprocmask_stats, 0},
+        {"atomic_add",    LOCK_KERNEL(OSM_LOCK_FETCH_ADD, 1), 0},
+        {"atomic_add_contended", LOCK_KERNEL(OSM_LOCK_FETCH_ADD, osm_lock_contenders()), 0},
+        {"atomic_cas",    LOCK_KERNEL(OSM_LOCK_CAS, 1), 0},
+        {"atomic_cas_contended", LOCK_KERNEL(OSM_LOCK_CAS, osm_lock_contenders()), 0},
+        {"mutex",         LOCK_KERNEL(OSM_LOCK_MUTEX, 1), 0},
+        {"mutex_contended", LOCK_KERNEL(OSM_LOCK_MUTEX, osm_lock_contenders()), 0},
+        {"spinlock",      LOCK_KERNEL(OSM_LOCK_SPINLOCK, 1), 0},
+        {"spinlock_contended", LOCK_KERNEL(OSM_LOCK_SPINLOCK, osm_lock_contenders()), 0},
+        {"semaphore",     LOCK_KERNEL(OSM_LOCK_SEMAPHORE, 1), 0},
+        {"semaphore_contended", LOCK_KERNEL(OSM_LOCK_SEMAPHORE, osm_lock_contenders()), 0},
+        {"condvar_broadcast", LOCK_KERNEL(OSM_LOCK_CONDVAR, osm_lock_contenders()), 0},
+        {"barrier",       LOCK_KERNEL(OSM_LOCK_BARRIER, osm_lock_contenders()), 0},
+        {"fault_minor",   FAULT_KERNEL(OSM_FAULT_MINOR), 0},
+        {"fault_huge",    FAULT_KERNEL(OSM_FAULT_HUGE), 0},
+        {"fault_major",   FAULT_KERNEL(OSM_FAULT_MAJOR), 0},
+        {"mmap_4k",       MMAP_KERNEL(4096), 0},
+        {"mmap_2m",       MMAP_KERNEL(2 * 1024 * 1024), 0},
+        {"mmap_1g",       MMAP_KERNEL(1024 * 1024 * 1024), 0},
+        {"madvise",       MADVISE_KERNEL(0), 0},
+        {"madvise_shootdown", MADVISE_KERNEL(1), 0},
+        {"file_read",     IO_KERNEL(OSM_IO_FILE_READ)},
+        {"file_write",    IO_KERNEL(OSM_IO_FILE_WRITE)},
+        {"pipe_rtt",      IO_KERNEL(OSM_IO_PIPE)},
+        {"unix_rtt",      IO_KERNEL(OSM_IO_UNIX)},
+        {"tcp_rtt",       IO_KERNEL(OSM_IO_TCP)},
+        {"writev_1b",     IO_KERNEL(OSM_IO_WRITEV)},
+        {"send_1b",       IO_KERNEL(OSM_IO_SEND)},
+        {"uring_nop",     IO_KERNEL(OSM_IO_URING)},
+        {"int_add_lat",   ARITH_KERNEL(latency, OSM_ARITH_INT_ADD), 0},
+        {"int_add_tput",  ARITH_KERNEL(throughput, OSM_ARITH_INT_ADD), 0},
+        {"int_mul_lat",   ARITH_KERNEL(latency, OSM_ARITH_INT_MUL), 0},
+        {"int_mul_tput",  ARITH_KERNEL(throughput, OSM_ARITH_INT_MUL), 0},
+        {"int_div_lat",   ARITH_KERNEL(latency, OSM_ARITH_INT_DIV), 0},
+        {"int_div_tput",  ARITH_KERNEL(throughput, OSM_ARITH_INT_DIV), 0},
+        {"fp_add_lat",    ARITH_KERNEL(latency, OSM_ARITH_FP_ADD), 0},
+        {"fp_add_tput",   ARITH_KERNEL(throughput, OSM_ARITH_FP_ADD), 0},
+        {"fp_mul_lat",    ARITH_KERNEL(latency, OSM_ARITH_FP_MUL), 0},
+        {"fp_mul_tput",   ARITH_KERNEL(throughput, OSM_ARITH_FP_MUL), 0},
+        {"fp_div_lat",    ARITH_KERNEL(latency, OSM_ARITH_FP_DIV), 0},
+        {"fp_div_tput",   ARITH_KERNEL(throughput, OSM_ARITH_FP_DIV), 0},
+};
+
+
+/* Returns the registered kernels, and their number in count.
+   */
+const osm_kernel *osm_kernels(unsigned int *count){
+    if (count != nullptr){
+        *count = sizeof(KERNEL_REGISTRY) / sizeof(KERNEL_REGISTRY[0]);
+    }
+    return KERNEL_REGISTRY;
+}
@@ -0,0 +1,114 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <sched.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+const double NANO_PER_SECOND = 1e9;
+
+/* The start line of a scaling run: threads report ready and wait for go,
+   which is 1 to run the kernel and -1 to give up.
+   */
+struct StartLine {
+    std::atomic<unsigned int> ready;
+    std::atomic<int> go;
+};
+
+/* State of one thread of a scaling run.
+   */
+struct ScalingThread {
+    osm_stats_func kernel;
+    unsigned int iterations;
+    const osm_stats_options *options;
+    StartLine *start;
+    osm_stats stats;
+    int status;
+};
+
+// forward declarations
+void *scalingMain(void *arg);
+
+
+/* Runs kernel on threads threads at once and summarizes their results.
+   With pinned, thread i is pinned to CPU i of osm_core_ids (wrapping around
+   when there are more threads than CPUs).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_scaling_run(osm_stats_func kernel, unsigned int threads, int pinned, unsigned int iterations,
+                    const osm_stats_options *options, osm_scaling_result *result){
+    if (kernel == nullptr || threads == 0 || result == nullptr){
+        return -1;
+    }
+
+    std::vector<int> cpus;
+    if (pinned){
+        int count = osm_core_count();
+        if (count <= 0){
+            return -1;
+        }
+        cpus.resize(count);
+        if (osm_core_ids(cpus.data(), count) != 0){
+            return -1;
+        }
+    }
+
+    StartLine start;
+    start.ready = 0;
+    start.go = 0;
+    std::vector<ScalingThread> runs(threads, ScalingThread{kernel, iterations, options, &start, {}, -1});
+    std::vector<pthread_t> handles(threads);
+
+    unsigned int started = 0;
+    for (; started < threads; started++){
+        int cpu = pinned ? cpus[started % cpus.size()] : -1;
+        if (startPinned(handles[started], cpu, scalingMain, &runs[started]) != 0){
+            break;
+        }
+    }
+    // all threads start the kernel together, or none does
+    while (start.ready.load() < started){
+        sched_yield();
+    }
+    start.go = (started == threads) ? 1 : -1;
+    for (unsigned int i = 0; i < started; i++){
+        pthread_join(handles[i], nullptr);
+    }
+    if (started != threads){
+        return -1;
+    }
+
+    std::vector<double> medians;
+    double throughput = 0;
+    for (const ScalingThread &run : runs){
+        if (run.status != 0 || run.stats.median <= 0){
+            return -1;
+        }
+        medians.push_back(run.stats.median);
+        // every thread runs its iterations one after the other
+        throughput += NANO_PER_SECOND / run.stats.median;
+    }
+    std::sort(medians.begin(), medians.end());
+    size_t middle = medians.size() / 2;
+    result->threads = threads;
+    result->latency = (medians.size() % 2 == 1) ? medians[middle] :
+                      (medians[middle - 1] + medians[middle]) / 2;
+    result->latency_max = medians.back();
+    result->throughput = throughput;
+    return 0;
+}
+
+
+/* Waits for all threads of the run, then runs the kernel on this one. */
+void *scalingMain(void *arg){
+    auto run = (ScalingThread *) arg;
+    run->start->ready++;
+    while (run->start->go.load() == 0){
+        sched_yield();
+    }
+    if (run->start->go.load() > 0){
+        run->status = run->kernel(run->iterations, run->options, &run->stats);
+    }
+    return nullptr;
+}
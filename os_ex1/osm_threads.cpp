@@ -0,0 +1,150 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <sched.h>
+#include <setjmp.h>
+#include <signal.h>
+
+const unsigned int DEFAULT_THREAD_ITERS = 1000;
+const unsigned int DEFAULT_SWITCH_ITERS = 100000;
+
+thread_local sigjmp_buf switchEnv;
+
+// forward declarations
+void *emptyThread(void *arg);
+
+
+/* Time measurement function for creating and joining an empty thread.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_thread_create_measure(unsigned int iterations, osm_measurement *result){
+    unsigned int threads = (iterations == 0) ? DEFAULT_THREAD_ITERS : iterations;
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < threads; i++){
+        pthread_t thread;
+        if (pthread_create(&thread, nullptr, emptyThread, nullptr) != 0 ||
+            pthread_join(thread, nullptr) != 0){
+            return -1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+
+    return getMeasurement(ticksBefore, ticksAfter, threads, result);
+}
+
+
+/* Time measurement function for a kernel thread context switch: half of a futex
+   round trip between two threads pinned to the CPU the caller runs on.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_thread_switch_measure(unsigned int iterations, osm_measurement *result){
+    int cpu = sched_getcpu();
+    if (cpu < 0 || result == nullptr){
+        return -1;
+    }
+
+    unsigned int roundTrips = (iterations == 0) ? DEFAULT_SWITCH_ITERS : iterations;
+    if (osm_core_pair_measure(OSM_CORE_FUTEX, cpu, cpu, roundTrips, result) != 0){
+        return -1;
+    }
+
+    // every round trip switches away and back
+    result->nanoseconds /= 2;
+    result->cycles = (result->cycles < 0) ? result->cycles : result->cycles / 2;
+    return 0;
+}
+
+
+/* Time measurement function for saving a context with its signal mask and jumping
+   back into it, like every uthreads context switch does.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_sigjmp_switch_measure(unsigned int iterations, osm_measurement *result){
+    // changed between sigsetjmp and siglongjmp, so it must live in memory
+    volatile unsigned int i;
+    unsigned int switches = (iterations == 0) ? DEFAULT_SWITCH_ITERS : iterations;
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (i = 0; i < switches; i = i + 1){
+        if (sigsetjmp(switchEnv, 1) == 0){
+            siglongjmp(switchEnv, 1);
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+
+    return getMeasurement(ticksBefore, ticksAfter, switches, result);
+}
+
+
+/* Time measurement function for blocking and unblocking SIGVTALRM.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_sigprocmask_measure(unsigned int iterations, osm_measurement *result){
+    unsigned int pairs = (iterations == 0) ? DEFAULT_SWITCH_ITERS : iterations;
+    sigset_t alarmSet;
+    if (sigemptyset(&alarmSet) != 0 || sigaddset(&alarmSet, SIGVTALRM) != 0){
+        return -1;
+    }
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < pairs; i++){
+        if (sigprocmask(SIG_BLOCK, &alarmSet, nullptr) != 0 ||
+            sigprocmask(SIG_UNBLOCK, &alarmSet, nullptr) != 0){
+            return -1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+
+    return getMeasurement(ticksBefore, ticksAfter, pairs, result);
+}
+
+
+int osm_thread_create_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_thread_create_measure, iterations, options, stats);
+}
+
+int osm_thread_switch_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_thread_switch_measure, iterations, options, stats);
+}
+
+int osm_sigjmp_switch_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_sigjmp_switch_measure, iterations, options, stats);
+}
+
+int osm_sigprocmask_stats(unsigned int iterations, const osm_stats_options *options, osm_stats *stats){
+    return runStats(osm_sigprocmask_measure, iterations, options, stats);
+}
+
+
+/* Body of the threads created by osm_thread_create_measure. */
+void *emptyThread(void *arg){
+    return arg;
+}
@@ -0,0 +1,364 @@
+#include "osm.h"
+#include "osm_internal.h"
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define BASE_PAGE 4096
+#define HUGE_PAGE (2 * 1024 * 1024)
+
+const unsigned int DEFAULT_FAULT_PAGES = 4096;
+const unsigned int DEFAULT_MAPPINGS = 10000;
+const char *DEFAULT_FILE_DIR = "/var/tmp";   // /tmp is often tmpfs, which is never cold
+
+/* A file whose pages the major fault kernel maps after dropping them from the page cache.
+   */
+struct ColdFile {
+    int fd;
+    size_t size;
+};
+
+ColdFile coldFile{-1, 0};
+std::mutex coldFileMutex;   // threads of a scaling sweep share the file
+
+// consumed reads of the fault kernels, so they cannot be optimized away
+volatile char faultSink;
+
+/* A thread that keeps the address space active on another CPU, so that every unmapping
+   has to shoot down that CPU's TLB.
+   */
+struct Bystander {
+    pthread_t thread;
+    std::atomic<bool> running;
+    std::atomic<bool> stop;
+};
+
+// forward declarations
+const osm_stats_options *withoutTarget(const osm_stats_options *options, osm_stats_options &fixed);
+char *mapAnonymous(size_t size, int advice, char *&mapping, size_t &mappingSize);
+char *mapColdFile(size_t size, char *&mapping, size_t &mappingSize);
+int ensureColdFile(size_t size);
+void closeColdFile();
+int startBystander(Bystander &bystander);
+void stopBystander(Bystander &bystander);
+void *bystanderMain(void *arg);
+
+
+/* Time measurement function for faulting in one 4 KiB page of memory, chosen by kind.
+   iterations is the number of pages touched (0 for the default).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_fault_measure(osm_fault_kind kind, unsigned int iterations, osm_measurement *result){
+    unsigned int pages = (iterations == 0) ? DEFAULT_FAULT_PAGES : iterations;
+    if (kind == OSM_FAULT_HUGE){
+        const unsigned int perHuge = HUGE_PAGE / BASE_PAGE;
+        pages += (perHuge - pages % perHuge) % perHuge;
+    }
+    size_t size = (size_t) pages * BASE_PAGE;
+
+    char *mapping = nullptr;
+    size_t mappingSize = 0;
+    char *region = nullptr;
+    switch (kind){
+        case OSM_FAULT_MINOR:
+            region = mapAnonymous(size, MADV_NOHUGEPAGE, mapping, mappingSize);
+            break;
+        case OSM_FAULT_HUGE:
+            region = mapAnonymous(size, MADV_HUGEPAGE, mapping, mappingSize);
+            break;
+        case OSM_FAULT_MAJOR:
+            region = mapColdFile(size, mapping, mappingSize);
+            break;
+        default:
+            return -1;
+    }
+    if (region == nullptr){
+        return -1;
+    }
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    int status = clockStart(ticksBefore);
+
+    char sum = 0;
+    for (size_t offset = 0; offset < size; offset += BASE_PAGE){
+        if (kind == OSM_FAULT_MAJOR){
+            sum += region[offset];
+        } else {
+            region[offset] = 1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        status = -1;
+    }
+    faultSink = sum;
+
+    munmap(mapping, mappingSize);
+    if (status != 0){
+        return -1;
+    }
+    return getMeasurement(ticksBefore, ticksAfter, pages, result);
+}
+
+
+int osm_fault_stats(osm_fault_kind kind, unsigned int iterations, const osm_stats_options *options,
+                    osm_stats *stats){
+    osm_stats_options fixed;
+    return runStats([kind](unsigned int pages, osm_measurement *result) {
+        return osm_fault_measure(kind, pages, result);
+    }, iterations, withoutTarget(options, fixed), stats);
+}
+
+
+/* Time measurement function for an mmap and munmap pair of an anonymous mapping of
+   size bytes, none of which is touched.
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_mmap_measure(size_t size, unsigned int iterations, osm_measurement *result){
+    unsigned int mappings = (iterations == 0) ? DEFAULT_MAPPINGS : iterations;
+    if (size == 0){
+        return -1;
+    }
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    if (clockStart(ticksBefore) != 0){
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < mappings; i++){
+        void *mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED || munmap(mapping, size) != 0){
+            return -1;
+        }
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        return -1;
+    }
+
+    return getMeasurement(ticksBefore, ticksAfter, mappings, result);
+}
+
+
+int osm_mmap_stats(size_t size, unsigned int iterations, const osm_stats_options *options,
+                   osm_stats *stats){
+    return runStats([size](unsigned int mappings, osm_measurement *result) {
+        return osm_mmap_measure(size, mappings, result);
+    }, iterations, options, stats);
+}
+
+
+/* Time measurement function for releasing one resident 4 KiB page with
+   madvise(MADV_DONTNEED). With shootdown, another thread of the process spins on
+   another CPU meanwhile, so the release also has to invalidate that CPU's TLB;
+   this fails on a single CPU.
+   iterations is the number of pages released at once (0 for the default).
+   returns 0 upon success, and -1 upon failure.
+   */
+int osm_madvise_measure(int shootdown, unsigned int iterations, osm_measurement *result){
+    unsigned int pages = (iterations == 0) ? DEFAULT_FAULT_PAGES : iterations;
+    size_t size = (size_t) pages * BASE_PAGE;
+
+    char *mapping = nullptr;
+    size_t mappingSize = 0;
+    char *region = mapAnonymous(size, MADV_NOHUGEPAGE, mapping, mappingSize);
+    if (region == nullptr){
+        return -1;
+    }
+    memset(region, 1, size);
+
+    Bystander bystander;
+    if (shootdown && startBystander(bystander) != 0){
+        munmap(mapping, mappingSize);
+        return -1;
+    }
+
+    // start time
+    uint64_t ticksBefore, ticksAfter;
+    int status = clockStart(ticksBefore);
+
+    if (madvise(region, size, MADV_DONTNEED) != 0){
+        status = -1;
+    }
+
+    // end
+    if (clockStop(ticksAfter) != 0){
+        status = -1;
+    }
+
+    if (shootdown){
+        stopBystander(bystander);
+    }
+    munmap(mapping, mappingSize);
+    if (status != 0){
+        return -1;
+    }
+    return getMeasurement(ticksBefore, ticksAfter, pages, result);
+}
+
+
+int osm_madvise_stats(int shootdown, unsigned int iterations, const osm_stats_options *options,
+                      osm_stats *stats){
+    osm_stats_options fixed;
+    return runStats([shootdown](unsigned int pages, osm_measurement *result) {
+        return osm_madvise_measure(shootdown, pages, result);
+    }, iterations, withoutTarget(options, fixed), stats);
+}
+
+
+/* Closes the file kept by the major fault kernel.
+   */
+void vmFinalize(){
+    std::lock_guard<std::mutex> lock(coldFileMutex);
+    closeColdFile();
+}
+
+
+/* Closes the cold file, if it is open. */
+void closeColdFile(){
+    if (coldFile.fd >= 0){
+        close(coldFile.fd);
+    }
+    coldFile.fd = -1;
+    coldFile.size = 0;
+}
+
+
+/* Returns options with the sample duration target cleared (in fixed), as the iterations
+   of the page kernels are memory, which must not grow with the speed of the host.
+   */
+const osm_stats_options *withoutTarget(const osm_stats_options *options, osm_stats_options &fixed){
+    if (options == nullptr){
+        return nullptr;
+    }
+    fixed = *options;
+    fixed.target_ms = 0;
+    return &fixed;
+}
+
+/* Maps an anonymous, untouched region of size bytes aligned to a huge page, and
+   applies advice to it. mapping and mappingSize receive what must later be unmapped.
+   Returns the region, or nullptr upon failure.
+   */
+char *mapAnonymous(size_t size, int advice, char *&mapping, size_t &mappingSize){
+    mappingSize = size + HUGE_PAGE;
+    void *data = mmap(nullptr, mappingSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED){
+        return nullptr;
+    }
+    mapping = (char *) data;
+    char *region = (char *) (((uintptr_t) mapping + HUGE_PAGE - 1) & ~(uintptr_t) (HUGE_PAGE - 1));
+    // the kernel may not support the advice, which then just leaves its default
+    madvise(region, size, advice);
+    return region;
+}
+
+/* Maps the first size bytes of the cold file, none of them in the page cache.
+   mapping and mappingSize receive what must later be unmapped.
+   Returns the region, or nullptr upon failure.
+   */
+char *mapColdFile(size_t size, char *&mapping, size_t &mappingSize){
+    std::lock_guard<std::mutex> lock(coldFileMutex);
+    if (ensureColdFile(size) != 0){
+        return nullptr;
+    }
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, coldFile.fd, 0);
+    if (data == MAP_FAILED){
+        return nullptr;
+    }
+    mapping = (char *) data;
+    mappingSize = size;
+    // no read-ahead, so that every page is a fault of its own
+    madvise(mapping, size, MADV_RANDOM);
+    return mapping;
+}
+
+/* Makes the cold file at least size bytes long, written to disk and
+   dropped from the page cache. The file lives in $TMPDIR, or else in /var/tmp.
+   The caller holds coldFileMutex.
+   returns 0 upon success, and -1 upon failure.
+   */
+int ensureColdFile(size_t size){
+    if (coldFile.fd < 0 || coldFile.size < size){
+        closeColdFile();
+        const char *dir = getenv("TMPDIR");
+        std::string path = std::string((dir != nullptr) ? dir : DEFAULT_FILE_DIR) + "/osm_fault_XXXXXX";
+        std::vector<char> name(path.begin(), path.end());
+        name.push_back('\0');
+        int fd = mkstemp(name.data());
+        if (fd < 0){
+            return -1;
+        }
+        unlink(name.data());
+        coldFile.fd = fd;
+
+        std::vector<char> page(BASE_PAGE, 1);
+        for (size_t offset = 0; offset < size; offset += BASE_PAGE){
+            if (pwrite(fd, page.data(), BASE_PAGE, (off_t) offset) != BASE_PAGE){
+                closeColdFile();
+                return -1;
+            }
+        }
+        coldFile.size = size;
+    }
+    // only clean pages can be dropped
+    if (fdatasync(coldFile.fd) != 0 ||
+        posix_fadvise(coldFile.fd, 0, (off_t) coldFile.size, POSIX_FADV_DONTNEED) != 0){
+        return -1;
+    }
+    return 0;
+}
+
+/* Starts bystander on a CPU other than the one the caller runs on.
+   returns 0 upon success, and -1 upon failure.
+   */
+int startBystander(Bystander &bystander){
+    int count = osm_core_count();
+    if (count < 2){
+        return -1;
+    }
+    std::vector<int> ids(count);
+    if (osm_core_ids(ids.data(), count) != 0){
+        return -1;
+    }
+    int cpu = (ids[0] == sched_getcpu()) ? ids[1] : ids[0];
+
+    bystander.running = false;
+    bystander.stop = false;
+    if (startPinned(bystander.thread, cpu, bystanderMain, &bystander) != 0){
+        return -1;
+    }
+
+    while (!bystander.running.load()){
+        sched_yield();
+    }
+    return 0;
+}
+
+/* Stops bystander and waits for it. */
+void stopBystander(Bystander &bystander){
+    bystander.stop = true;
+    pthread_join(bystander.thread, nullptr);
+}
+
+/* Spins in the address space until told to stop. */
+void *bystanderMain(void *arg){
+    auto bystander = (Bystander *) arg;
+    bystander->running = true;
+    while (!bystander->stop.load()){
+        cpuRelax();
+    }
+    return nullptr;
+}
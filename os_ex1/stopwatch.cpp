@@ -1,80 +1,681 @@
 #include "osm.h"
 #include <iostream>
+#include <cmath>
 #include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <string>
+#include <vector>
 
-double time_of_operation(unsigned int iterations) {
-    osm_init();
-    double result = osm_operation_time(iterations);
-    osm_finalizer();
-    return result;
+/*
+ * stopwatch -- command line driver for the osm library.
+ *
+ * Measures the selected kernels and writes the results as a text table, JSON or CSV.
+ * Given a baseline file (JSON or CSV, as written by an earlier run), compares the
+ * median of every kernel against it and exits with EXIT_REGRESSION if any kernel
+ * got slower than the allowed threshold, failed, or was not run although all kernels were
+ * selected.
+ */
+
+#define EXIT_REGRESSION 2
+
+const double DEFAULT_THRESHOLD_PERCENT = 10.0;
+const double DEFAULT_TARGET_MS = 10.0;
+
+
+enum OutputFormat {
+    text, json, csv
+};
+
+struct Options {
+    unsigned int iterations = 0;
+    osm_stats_options stats{0, 3, 3.5, DEFAULT_TARGET_MS};
+    std::vector<const osm_kernel *> kernels;
+    bool allKernels = false;
+    osm_clock clock = OSM_CLOCK_MONOTONIC_RAW;
+    OutputFormat format = text;
+    std::string outputPath;
+    std::string baselinePath;
+    double thresholdPercent = DEFAULT_THRESHOLD_PERCENT;
+    bool matrix = false;
+    bool counters = false;
+    size_t memoryMax = 0;
+    unsigned int scalingMax = 0;
+    bool pinned = false;
+};
+
+struct Result {
+    const osm_kernel *kernel;
+    bool ok;
+    osm_stats stats;
+};
+
+
+void usage(const char *prog) {
+    std::cerr << "Usage: " << prog << " [options]\n"
+              << "  -i, --iterations N    iterations per sample (0 - calibrated to the target)\n"
+              << "  -T, --target MS       calibrate samples to last MS milli-seconds (default "
+              << DEFAULT_TARGET_MS << ", 0 - kernel defaults)\n"
+              << "  -r, --repetitions N   samples per kernel (0 - default value)\n"
+              << "  -w, --warmup N        discarded warm-up rounds per kernel\n"
+              << "  -k, --kernels LIST    comma separated kernels to run (default all)\n"
+              << "  -c, --clock NAME      tsc, monotonic_raw or gettimeofday\n"
+              << "  -f, --format NAME     text, json or csv\n"
+              << "  -o, --output FILE     write results to FILE instead of stdout\n"
+              << "  -b, --baseline FILE   compare medians against a stored json/csv run\n"
+              << "  -t, --threshold PCT   allowed median regression in percent (default "
+              << DEFAULT_THRESHOLD_PERCENT << ")\n"
+              << "  -p, --counters        sample hardware performance counters, if available\n"
+              << "  -M, --memory MAX      print the memory latency and bandwidth curve from\n"
+              << "                        4K to MAX bytes (K, M and G suffixes) instead\n"
+              << "  -m, --matrix          print the cross-core latency matrices instead\n"
+              << "  -L, --lock-threads N  threads of the contended lock kernels (0 - one per CPU)\n"
+              << "  -s, --scaling N       run every kernel on 1 to N threads at once instead\n"
+              << "  -a, --affinity        pin the scaling threads to distinct CPUs\n"
+              << "Kernels:";
+    unsigned int count;
+    const osm_kernel *kernels = osm_kernels(&count);
+    for (unsigned int i = 0; i < count; i++) {
+        std::cerr << " " << kernels[i].name;
+    }
+    std::cerr << std::endl;
 }
 
 
-double time_of_function(unsigned int iterations) {
-    osm_init();
-    double result = osm_function_time(iterations);
-    osm_finalizer();
-    return result;
+const char *clock_name(osm_clock clock) {
+    switch (clock) {
+        case OSM_CLOCK_TSC:
+            return "tsc";
+        case OSM_CLOCK_GETTIMEOFDAY:
+            return "gettimeofday";
+        default:
+            return "monotonic_raw";
+    }
 }
 
 
-double time_of_syscall(unsigned int iterations) {
-    osm_init();
-    double result = osm_syscall_time(iterations);
-    osm_finalizer();
-    return result;
+int parse_unsigned(const char *arg, unsigned int &value) {
+    char *end;
+    long parsed = strtol(arg, &end, 10);
+    if (*arg == '\0' || *end != '\0' || parsed < 0) {
+        return -1;
+    }
+    value = (unsigned int) parsed;
+    return 0;
 }
 
 
-int main() {
-    // Auto Setting of iters
-//    unsigned int iters = 1000;
-//    std::cout << "Auto mode of iterations settings" << std::endl;
-//    unsigned int iters = 1000000;
-//    std::cout << "Auto mode of iterations set to MILLION" << std::endl;
+int parse_double(const char *arg, double &value) {
+    char *end;
+    double parsed = strtod(arg, &end);
+    if (*arg == '\0' || *end != '\0' || !std::isfinite(parsed) || parsed < 0) {
+        return -1;
+    }
+    value = parsed;
+    return 0;
+}
 
-    // Manual setting of iters
-    // If using need to turn on back redirection at the bottom
-    unsigned int iters;
-    std::cout << "Enter num of iters (0 - default value): " << std::endl;
-    std::cin >> iters;
 
-    int times = 1;
+int parse_size(const char *arg, size_t &value) {
+    char *end;
+    unsigned long long parsed = strtoull(arg, &end, 10);
+    switch (*end) {
+        case 'G':
+            parsed *= 1024;
+            // fall through
+        case 'M':
+            parsed *= 1024;
+            // fall through
+        case 'K':
+            parsed *= 1024;
+            end++;
+            break;
+        default:
+            break;
+    }
+    if (*arg == '\0' || *end != '\0' || parsed == 0) {
+        return -1;
+    }
+    value = (size_t) parsed;
+    return 0;
+}
 
-    // Output to file.
-//    std::ofstream outfile("results.txt");
-//    std::streambuf * cout_std_buf = std::cout.rdbuf(); //save old buf
-//    std::cout.rdbuf(outfile.rdbuf()); //redirect std::cout to out.txt!
+
+int parse_kernels(const std::string &list, std::vector<const osm_kernel *> &kernels) {
+    std::stringstream names(list);
+    std::string name;
+    while (std::getline(names, name, ',')) {
+        unsigned int count;
+        const osm_kernel *registry = osm_kernels(&count);
+        const osm_kernel *found = nullptr;
+        for (unsigned int i = 0; i < count; i++) {
+            if (name == registry[i].name) {
+                found = &registry[i];
+            }
+        }
+        if (found == nullptr) {
+            std::cerr << "Unknown kernel: " << name << std::endl;
+            return -1;
+        }
+        kernels.push_back(found);
+    }
+    return 0;
+}
 
 
-    for (int i=0 ; i< times; i++) {
-        double operation = time_of_operation(iters);
-        if (operation == -1) {
-            std::cout << "Error in Operation time" << std::endl;
-        } else {
-            std::cout << "osm_operation_time result: " << operation << std::endl;
+int parse_options(int argc, char *argv[], Options &options) {
+    const option longOptions[] = {
+            {"iterations",  required_argument, nullptr, 'i'},
+            {"repetitions", required_argument, nullptr, 'r'},
+            {"warmup",      required_argument, nullptr, 'w'},
+            {"kernels",     required_argument, nullptr, 'k'},
+            {"clock",       required_argument, nullptr, 'c'},
+            {"format",      required_argument, nullptr, 'f'},
+            {"output",      required_argument, nullptr, 'o'},
+            {"baseline",    required_argument, nullptr, 'b'},
+            {"threshold",   required_argument, nullptr, 't'},
+            {"counters",    no_argument,       nullptr, 'p'},
+            {"memory",      required_argument, nullptr, 'M'},
+            {"matrix",      no_argument,       nullptr, 'm'},
+            {"target",      required_argument, nullptr, 'T'},
+            {"lock-threads", required_argument, nullptr, 'L'},
+            {"scaling",     required_argument, nullptr, 's'},
+            {"affinity",    no_argument,       nullptr, 'a'},
+            {"help",        no_argument,       nullptr, 'h'},
+            {nullptr, 0,                       nullptr, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:r:w:k:c:f:o:b:t:T:pM:mL:s:ah", longOptions, nullptr)) != -1) {
+        switch (opt) {
+            case 'i':
+                if (parse_unsigned(optarg, options.iterations) != 0) { return -1; }
+                break;
+            case 'r':
+                if (parse_unsigned(optarg, options.stats.repetitions) != 0) { return -1; }
+                break;
+            case 'w':
+                if (parse_unsigned(optarg, options.stats.warmup) != 0) { return -1; }
+                break;
+            case 'k':
+                if (parse_kernels(optarg, options.kernels) != 0) { return -1; }
+                break;
+            case 'c':
+                if (strcmp(optarg, "tsc") == 0) {
+                    options.clock = OSM_CLOCK_TSC;
+                } else if (strcmp(optarg, "monotonic_raw") == 0) {
+                    options.clock = OSM_CLOCK_MONOTONIC_RAW;
+                } else if (strcmp(optarg, "gettimeofday") == 0) {
+                    options.clock = OSM_CLOCK_GETTIMEOFDAY;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'f':
+                if (strcmp(optarg, "text") == 0) {
+                    options.format = text;
+                } else if (strcmp(optarg, "json") == 0) {
+                    options.format = json;
+                } else if (strcmp(optarg, "csv") == 0) {
+                    options.format = csv;
+                } else {
+                    return -1;
+                }
+                break;
+            case 'o':
+                options.outputPath = optarg;
+                break;
+            case 'b':
+                options.baselinePath = optarg;
+                break;
+            case 't':
+                if (parse_double(optarg, options.thresholdPercent) != 0) { return -1; }
+                break;
+            case 'T':
+                if (parse_double(optarg, options.stats.target_ms) != 0) { return -1; }
+                break;
+            case 'p':
+                options.counters = true;
+                break;
+            case 'M':
+                if (parse_size(optarg, options.memoryMax) != 0) { return -1; }
+                break;
+            case 'm':
+                options.matrix = true;
+                break;
+            case 'L': {
+                unsigned int threads;
+                if (parse_unsigned(optarg, threads) != 0) { return -1; }
+                osm_set_lock_contenders(threads);
+                break;
+            }
+            case 's':
+                if (parse_unsigned(optarg, options.scalingMax) != 0) { return -1; }
+                break;
+            case 'a':
+                options.pinned = true;
+                break;
+            default:
+                return -1;
         }
     }
+    if (optind != argc) {
+        return -1;
+    }
 
-    for (int i=0 ; i< times; i++) {
-        double function = time_of_function(iters);
-        if (function == -1) {
-            std::cout << "Error in Function time" << std::endl;
-        } else {
-            std::cout << "osm_function_time result: " << function << std::endl;
+    if (options.kernels.empty()) {
+        options.allKernels = true;
+        unsigned int count;
+        const osm_kernel *registry = osm_kernels(&count);
+        for (unsigned int i = 0; i < count; i++) {
+            options.kernels.push_back(&registry[i]);
         }
     }
+    return 0;
+}
 
-    for (int i=0 ; i< times; i++) {
-        double sysCall = time_of_syscall(iters);
-        if (sysCall == -1) {
-            std::cout << "Error in SystemCall time" << std::endl;
+
+//// ============================   output ========================================================
+
+void write_text(std::ostream &out, const std::vector<Result> &results) {
+    out << "kernel\tmedian\tp90\tp99\tmean\tstddev\tcycles\trejected\titerations (ns per iteration)"
+        << std::endl;
+    for (const Result &result : results) {
+        out << result.kernel->name;
+        if (!result.ok) {
+            out << "\tunavailable" << std::endl;
+            continue;
+        }
+        const osm_stats &s = result.stats;
+        out << "\t" << s.median << "\t" << s.p90 << "\t" << s.p99 << "\t" << s.mean
+            << "\t" << s.stddev << "\t" << s.median_cycles
+            << "\t" << s.rejected << "/" << s.samples << "\t" << s.iterations << std::endl;
+    }
+    bool anyCounters = false;
+    for (const Result &result : results) {
+        anyCounters |= result.ok && result.stats.counters.valid;
+    }
+    if (anyCounters) {
+        out << "kernel\tinstr\tcycles\tIPC\tbr-miss\tL1D-miss\tLLC-miss\tdTLB-miss (per iteration)"
+            << std::endl;
+        for (const Result &result : results) {
+            const osm_counters &c = result.stats.counters;
+            if (!result.ok || !c.valid) {
+                continue;
+            }
+            out << result.kernel->name << "\t" << c.instructions << "\t" << c.cycles << "\t"
+                << c.ipc << "\t" << c.branch_misses << "\t" << c.l1d_misses << "\t"
+                << c.llc_misses << "\t" << c.dtlb_misses << std::endl;
+        }
+    }
+    bool anySyscalls = false;
+    for (const Result &result : results) {
+        anySyscalls |= result.ok && result.kernel->syscalls > 0;
+    }
+    if (anySyscalls) {
+        out << "kernel\tsyscalls\tns per syscall (per iteration)" << std::endl;
+        for (const Result &result : results) {
+            if (result.ok && result.kernel->syscalls > 0) {
+                out << result.kernel->name << "\t" << result.kernel->syscalls << "\t"
+                    << result.stats.median / result.kernel->syscalls << std::endl;
+            }
+        }
+    }
+    out << "TSC frequency: " << osm_tsc_ghz() << " GHz, timer overhead: "
+        << osm_timer_overhead() << " ns" << std::endl;
+}
+
+
+void write_json(std::ostream &out, const Options &options, const std::vector<Result> &results) {
+    out << "{\n"
+        << "  \"clock\": \"" << clock_name(options.clock) << "\",\n"
+        << "  \"iterations\": " << options.iterations << ",\n"
+        << "  \"tsc_ghz\": " << osm_tsc_ghz() << ",\n"
+        << "  \"timer_overhead_ns\": " << osm_timer_overhead() << ",\n"
+        << "  \"kernels\": [";
+    bool first = true;
+    for (const Result &result : results) {
+        if (!result.ok) {
+            continue;
+        }
+        const osm_stats &s = result.stats;
+        out << (first ? "\n" : ",\n")
+            << "    {\"name\": \"" << result.kernel->name << "\""
+            << ", \"samples\": " << s.samples << ", \"rejected\": " << s.rejected
+            << ", \"min\": " << s.min << ", \"median\": " << s.median
+            << ", \"p90\": " << s.p90 << ", \"p99\": " << s.p99 << ", \"max\": " << s.max
+            << ", \"mean\": " << s.mean << ", \"stddev\": " << s.stddev
+            << ", \"ci_low\": " << s.ci_low << ", \"ci_high\": " << s.ci_high
+            << ", \"median_cycles\": " << s.median_cycles << ", \"iterations\": " << s.iterations;
+        if (result.kernel->syscalls > 0) {
+            out << ", \"syscalls\": " << result.kernel->syscalls;
+        }
+        const osm_counters &c = s.counters;
+        if (c.valid) {
+            out << ", \"counters\": {\"instructions\": " << c.instructions
+                << ", \"cycles\": " << c.cycles << ", \"ipc\": " << c.ipc
+                << ", \"branch_misses\": " << c.branch_misses << ", \"l1d_misses\": " << c.l1d_misses
+                << ", \"llc_misses\": " << c.llc_misses << ", \"dtlb_misses\": " << c.dtlb_misses << "}";
+        }
+        out << "}";
+        first = false;
+    }
+    out << "\n  ]\n}" << std::endl;
+}
+
+
+void write_csv(std::ostream &out, const std::vector<Result> &results) {
+    out << "name,samples,rejected,min,median,p90,p99,max,mean,stddev,ci_low,ci_high,median_cycles,"
+        << "instructions,cycles,ipc,branch_misses,l1d_misses,llc_misses,dtlb_misses,syscalls,iterations" << std::endl;
+    for (const Result &result : results) {
+        if (!result.ok) {
+            continue;
+        }
+        const osm_stats &s = result.stats;
+        out << result.kernel->name << "," << s.samples << "," << s.rejected << ","
+            << s.min << "," << s.median << "," << s.p90 << "," << s.p99 << "," << s.max << ","
+            << s.mean << "," << s.stddev << "," << s.ci_low << "," << s.ci_high << ","
+            << s.median_cycles;
+        // counters are left empty when unavailable
+        const osm_counters &c = s.counters;
+        if (c.valid) {
+            out << "," << c.instructions << "," << c.cycles << "," << c.ipc << "," << c.branch_misses
+                << "," << c.l1d_misses << "," << c.llc_misses << "," << c.dtlb_misses;
         } else {
-            std::cout << "osm_syscall_time result: " << sysCall << std::endl;
+            out << ",,,,,,,";
+        }
+        out << ",";
+        if (result.kernel->syscalls > 0) {
+            out << result.kernel->syscalls;
+        }
+        out << "," << s.iterations << std::endl;
+    }
+}
+
+
+//// ============================   baseline ======================================================
+
+/* Reads the kernel medians of a run written with --format json.
+ */
+void parse_json_baseline(const std::string &content, std::map<std::string, double> &medians) {
+    const std::string nameKey = "\"name\": \"";
+    const std::string medianKey = "\"median\": ";
+    size_t pos = 0;
+    while ((pos = content.find(nameKey, pos)) != std::string::npos) {
+        size_t nameStart = pos + nameKey.size();
+        size_t nameEnd = content.find('"', nameStart);
+        size_t objectEnd = content.find('}', nameStart);
+        size_t median = content.find(medianKey, nameStart);
+        if (nameEnd == std::string::npos || median == std::string::npos || median > objectEnd) {
+            return;
+        }
+        medians[content.substr(nameStart, nameEnd - nameStart)] =
+                strtod(content.c_str() + median + medianKey.size(), nullptr);
+        pos = objectEnd;
+    }
+}
+
+
+/* Reads the kernel medians of a run written with --format csv.
+ */
+void parse_csv_baseline(const std::string &content, std::map<std::string, double> &medians) {
+    std::stringstream lines(content);
+    std::string line;
+    int medianColumn = -1;
+    while (std::getline(lines, line)) {
+        std::vector<std::string> fields;
+        std::stringstream cells(line);
+        std::string cell;
+        while (std::getline(cells, cell, ',')) {
+            fields.push_back(cell);
+        }
+        if (medianColumn < 0) {
+            // header line
+            for (unsigned int i = 0; i < fields.size(); i++) {
+                if (fields[i] == "median") {
+                    medianColumn = i;
+                }
+            }
+            if (medianColumn < 0) {
+                return;
+            }
+        } else if ((int) fields.size() > medianColumn) {
+            medians[fields[0]] = strtod(fields[medianColumn].c_str(), nullptr);
+        }
+    }
+}
+
+
+int load_baseline(const std::string &path, std::map<std::string, double> &medians) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Could not open baseline file " << path << std::endl;
+        return -1;
+    }
+    std::stringstream buffer;
+    buffer << in.rdbuf();
+    std::string content = buffer.str();
+
+    size_t first = content.find_first_not_of(" \t\r\n");
+    if (first != std::string::npos && content[first] == '{') {
+        parse_json_baseline(content, medians);
+    } else {
+        parse_csv_baseline(content, medians);
+    }
+    if (medians.empty()) {
+        std::cerr << "No kernel results in baseline file " << path << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+
+/* Prints a diff table of the medians against the baseline to stderr.
+ * Returns the number of baseline kernels that regressed past the threshold, failed in
+ * this run, or were not run although all kernels were selected. Baseline kernels left out
+ * by a kernel selection are listed, but not counted.
+ */
+int compare_to_baseline(const std::vector<Result> &results, const std::map<std::string, double> &baseline,
+                        double thresholdPercent, bool allSelected) {
+    int regressions = 0;
+    std::cerr << "kernel\tbaseline\tcurrent\tchange\tstatus (median ns)" << std::endl;
+    for (const Result &result : results) {
+        auto base = baseline.find(result.kernel->name);
+        if (base == baseline.end()) {
+            continue;
+        }
+        if (!result.ok) {
+            regressions++;
+            std::cerr << result.kernel->name << "\t" << base->second << "\tunavailable\t-\tFAILED"
+                      << std::endl;
+            continue;
+        }
+        double current = result.stats.median;
+        double change = (base->second > 0) ? 100.0 * (current - base->second) / base->second : 0;
+        bool regressed = change > thresholdPercent;
+        regressions += regressed;
+        std::cerr << result.kernel->name << "\t" << base->second << "\t" << current << "\t"
+                  << (change >= 0 ? "+" : "") << change << "%\t"
+                  << (regressed ? "REGRESSION" : "ok") << std::endl;
+    }
+    for (const auto &base : baseline) {
+        bool ran = false;
+        for (const Result &result : results) {
+            ran |= base.first == result.kernel->name;
+        }
+        if (!ran) {
+            regressions += allSelected;
+            std::cerr << base.first << "\t" << base.second << "\t-\t-\t"
+                      << (allSelected ? "MISSING" : "not selected") << std::endl;
         }
     }
+    return regressions;
+}
+
+
+//// ============================   cross core matrix =============================================
 
-    // turning Output to screen again.
-//    std::cout.rdbuf(cout_std_buf); //redirect std::cout to original cout.
-//    outfile.close();
+int print_core_matrix(const char *name, osm_core_test test, unsigned int iterations) {
+    int count = osm_core_count();
+    if (count <= 0) {
+        std::cout << "Error in core count" << std::endl;
+        return -1;
+    }
+    std::vector<int> ids(count);
+    std::vector<double> matrix(count * count);
+    if (osm_core_ids(ids.data(), count) != 0 ||
+        osm_core_matrix(test, iterations, matrix.data(), count) != 0) {
+        std::cout << "Error in " << name << " matrix" << std::endl;
+        return -1;
+    }
+
+    std::cout << name << " round trip (ns), rows initiate:" << std::endl << "cpu";
+    for (int id : ids) {
+        std::cout << "\t" << id;
+    }
+    std::cout << std::endl;
+    for (int row = 0; row < count; row++) {
+        std::cout << ids[row];
+        for (int col = 0; col < count; col++) {
+            std::cout << "\t" << matrix[row * count + col];
+        }
+        std::cout << std::endl;
+    }
+    return 0;
+}
+
+
+int run_core_matrices(unsigned int iterations) {
+    int status = 0;
+    status |= print_core_matrix("cache line ping-pong", OSM_CORE_PINGPONG, iterations);
+    status |= print_core_matrix("atomic CAS", OSM_CORE_CAS, iterations);
+    status |= print_core_matrix("futex wake-up", OSM_CORE_FUTEX, iterations);
+    return (status == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+
+//// ============================   memory curve ==================================================
+
+int run_memory_curve(const Options &options) {
+    const size_t minSize = 4 * 1024;
+    std::cout << "size\tlatency (ns)\tread\twrite\tcopy (GB/s)" << std::endl;
+    for (size_t size = minSize; size <= options.memoryMax; size *= 2) {
+        osm_stats latency{};
+        if (osm_memory_latency_stats(size, options.iterations, &options.stats, &latency) != 0) {
+            std::cout << "Error in memory latency for " << size << " bytes" << std::endl;
+            return EXIT_FAILURE;
+        }
+        std::cout << size / 1024 << "K\t" << latency.median
+                  << "\t" << osm_memory_bandwidth(OSM_STREAM_READ, size)
+                  << "\t" << osm_memory_bandwidth(OSM_STREAM_WRITE, size)
+                  << "\t" << osm_memory_bandwidth(OSM_STREAM_COPY, size) << std::endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+
+//// ============================   scaling sweep =================================================
+
+int run_scaling_sweep(const Options &options) {
+    int status = EXIT_SUCCESS;
+    std::cout << "kernel\tthreads\tlatency\tlatency_max (ns per iteration)\tthroughput (per second)"
+              << std::endl;
+    for (const osm_kernel *kernel : options.kernels) {
+        for (unsigned int threads = 1; threads <= options.scalingMax; threads++) {
+            osm_scaling_result result{};
+            if (osm_scaling_run(kernel->stats, threads, options.pinned, options.iterations,
+                                &options.stats, &result) != 0) {
+                std::cout << kernel->name << "\t" << threads << "\tunavailable" << std::endl;
+                status = EXIT_FAILURE;
+                break;
+            }
+            std::cout << kernel->name << "\t" << threads << "\t" << result.latency << "\t"
+                      << result.latency_max << "\t" << result.throughput << std::endl;
+        }
+    }
+    return status;
+}
+
+
+int main(int argc, char *argv[]) {
+    Options options;
+    if (parse_options(argc, argv, options) != 0) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (osm_init_clock(options.clock) != 0) {
+        std::cerr << "Error in osm_init with clock " << clock_name(options.clock) << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (options.counters && osm_enable_counters(1) != 0) {
+        std::cerr << "Hardware performance counters are unavailable, measuring time only" << std::endl;
+    }
+
+    if (options.memoryMax != 0) {
+        int status = run_memory_curve(options);
+        osm_finalizer();
+        return status;
+    }
+
+    if (options.matrix) {
+        int status = run_core_matrices(options.iterations);
+        osm_finalizer();
+        return status;
+    }
+
+    if (options.scalingMax != 0) {
+        int status = run_scaling_sweep(options);
+        osm_finalizer();
+        return status;
+    }
+
+    std::map<std::string, double> baseline;
+    if (!options.baselinePath.empty() && load_baseline(options.baselinePath, baseline) != 0) {
+        osm_finalizer();
+        return EXIT_FAILURE;
+    }
+
+    std::vector<Result> results;
+    for (const osm_kernel *kernel : options.kernels) {
+        Result result{kernel, false, {}};
+        result.ok = kernel->stats(options.iterations, &options.stats, &result.stats) == 0;
+        if (!result.ok) {
+            std::cerr << "Error in " << kernel->name << " measurement" << std::endl;
+        }
+        results.push_back(result);
+    }
+    osm_finalizer();
+
+    // Output to file, if requested.
+    std::ofstream outfile;
+    if (!options.outputPath.empty()) {
+        outfile.open(options.outputPath);
+        if (!outfile) {
+            std::cerr << "Could not open output file " << options.outputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+    }
+    std::ostream &out = options.outputPath.empty() ? std::cout : outfile;
+
+    switch (options.format) {
+        case json:
+            write_json(out, options, results);
+            break;
+        case csv:
+            write_csv(out, results);
+            break;
+        default:
+            write_text(out, results);
+    }
+
+    if (!baseline.empty() &&
+        compare_to_baseline(results, baseline, options.thresholdPercent, options.allKernels) > 0) {
+        return EXIT_REGRESSION;
+    }
+    return EXIT_SUCCESS;
 }
@@ -0,0 +1,130 @@
+#include "context.h"
+
+#include <stdint.h>
+
+/* Where a new context starts: calls the entry function kept in a callee-saved register. */
+extern "C" void contextStart();
+
+
+////===========================================   processor stuff ==================================
+/*
+ * switchContext pushes the callee-saved registers, and the floating point control words, which
+ * are callee-saved as well, on the current stack, and keeps the stack pointer in *save. Then it
+ * loads the stack pointer of the other context, pops its registers, and returns to where that
+ * context called switchContext (or to contextStart, for a new one). The caller-saved registers
+ * were saved by the compiler around the call, as for any call.
+ */
+#ifdef __x86_64__
+/* code for 64 bit Intel arch */
+
+#define SAVED_WORDS 8 /* control words, r15, r14, r13, r12, rbx, rbp, return address */
+#define ENTRY_WORD 4  /* r12 */
+
+asm(".text\n"
+    ".globl switchContext\n"
+    ".type switchContext, @function\n"
+    ".p2align 4\n"
+    "switchContext:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  subq $8, %rsp\n"
+    "  stmxcsr (%rsp)\n"
+    "  fnstcw 4(%rsp)\n"
+    "  movq %rsp, (%rdi)\n"
+    "  movq %rsi, %rsp\n"
+    "  ldmxcsr (%rsp)\n"
+    "  fldcw 4(%rsp)\n"
+    "  addq $8, %rsp\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size switchContext, .-switchContext\n"
+    ".globl contextStart\n"
+    ".hidden contextStart\n"
+    ".type contextStart, @function\n"
+    "contextStart:\n"
+    "  callq *%r12\n"
+    "  ud2\n"
+    ".size contextStart, .-contextStart\n");
+
+#else
+/* code for 32 bit Intel arch */
+
+#define SAVED_WORDS 7 /* control words (2 words), edi, esi, ebx, ebp, return address */
+#define ENTRY_WORD 4  /* ebx */
+
+asm(".text\n"
+    ".globl switchContext\n"
+    ".type switchContext, @function\n"
+    ".p2align 4\n"
+    "switchContext:\n"
+    "  movl 4(%esp), %eax\n"
+    "  movl 8(%esp), %edx\n"
+    "  pushl %ebp\n"
+    "  pushl %ebx\n"
+    "  pushl %esi\n"
+    "  pushl %edi\n"
+    "  subl $8, %esp\n"
+#ifdef __SSE__
+    "  stmxcsr (%esp)\n"
+#endif
+    "  fnstcw 4(%esp)\n"
+    "  movl %esp, (%eax)\n"
+    "  movl %edx, %esp\n"
+#ifdef __SSE__
+    "  ldmxcsr (%esp)\n"
+#endif
+    "  fldcw 4(%esp)\n"
+    "  addl $8, %esp\n"
+    "  popl %edi\n"
+    "  popl %esi\n"
+    "  popl %ebx\n"
+    "  popl %ebp\n"
+    "  ret\n"
+    ".size switchContext, .-switchContext\n"
+    ".globl contextStart\n"
+    ".hidden contextStart\n"
+    ".type contextStart, @function\n"
+    "contextStart:\n"
+    "  andl $-16, %esp\n"
+    "  call *%ebx\n"
+    "  ud2\n"
+    ".size contextStart, .-contextStart\n");
+
+#endif
+//// ========================================= END  processor stuff ================================
+
+#define DEFAULT_MXCSR 0x1f80 /* all exceptions masked, round to nearest */
+#define DEFAULT_FPU_CW 0x037f /* all exceptions masked, round to nearest, extended precision */
+
+/**
+ * Prepares a context that starts running entry on a fresh stack: a frame as switchContext
+ * leaves it, returning to contextStart, with entry in the register it calls.
+ * entry must not return.
+ * @param stackTop the end (highest address) of the stack
+ * @param entry the function the context starts with
+ * @return the new context.
+ */
+Context makeContext(char *stackTop, void (*entry)(void)) {
+
+  // the return address sits 8 bytes below a 16 byte boundary, like after a call
+  auto top = (uintptr_t *) ((uintptr_t) stackTop & ~(uintptr_t) 15) - 1;
+  uintptr_t *frame = top - (SAVED_WORDS - 1);
+  for (int i = 0; i < SAVED_WORDS; i++) {
+    frame[i] = 0;
+  }
+  auto controlWords = (uint32_t *) frame;
+  controlWords[0] = DEFAULT_MXCSR;
+  controlWords[1] = DEFAULT_FPU_CW;
+  frame[ENTRY_WORD] = (uintptr_t) entry;
+  frame[SAVED_WORDS - 1] = (uintptr_t) &contextStart;
+  return frame;
+}
@@ -0,0 +1,28 @@
+#ifndef OS_EX2_CONTEXT_H
+#define OS_EX2_CONTEXT_H
+
+/**
+ * The saved registers of a thread that isn't running. They are pushed on the thread's own
+ * stack, so all a context takes outside of it is the stack pointer.
+ */
+typedef void *Context;
+
+/**
+ * Prepares a context that starts running entry on a fresh stack.
+ * entry must not return.
+ * @param stackTop the end (highest address) of the stack
+ * @param entry the function the context starts with
+ * @return the new context.
+ */
+Context makeContext(char *stackTop, void (*entry)(void));
+
+/**
+ * Saves the registers of the caller in *save, and continues in the context load - without
+ * entering the kernel: the signal mask is left as it is. Returns once some other call
+ * switches back to *save.
+ * @param save where to keep the context of the caller
+ * @param load the context to continue in
+ */
+extern "C" void switchContext(Context *save, Context load);
+
+#endif //OS_EX2_CONTEXT_H
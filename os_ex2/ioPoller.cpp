@@ -0,0 +1,177 @@
+#include "ioPoller.h"
+
+#include <errno.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define POLL_EVENTS 64 // events taken from the epoll instance per poll
+
+/**
+ * Destructor of IoPoller object - closes the epoll instance.
+ */
+IoPoller::~IoPoller() {
+  close();
+}
+
+/**
+ * @return the waiters of fd, allocated on its first wait.
+ * @throws std::bad_alloc if they could not be allocated
+ */
+IoPoller::Waiters &IoPoller::waitersOf(int fd) {
+  if ((size_t) fd >= fds.size()) {
+    fds.resize((size_t) fd + 1, nullptr);
+  }
+  if (fds[fd] == nullptr) {
+    fds[fd] = new Waiters();
+  }
+  return *fds[fd];
+}
+
+/**
+ * Registers fd for the directions it has waiters in - or unregisters it, if it has none.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int IoPoller::update(int fd) {
+  Waiters &waiters = *fds[fd];
+  uint32_t events = (waiters.readers.empty() ? 0 : (uint32_t) EPOLLIN) |
+                    (waiters.writers.empty() ? 0 : (uint32_t) EPOLLOUT);
+  if (events == waiters.registered) {
+    return 0;
+  }
+
+  struct epoll_event event{};
+  event.events = events;
+  event.data.fd = fd;
+  int op = (events == 0) ? EPOLL_CTL_DEL : (waiters.registered == 0) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+  if (epoll_ctl(epollFd, op, fd, &event) < 0 && events != 0) {
+    // closing a descriptor unregisters it, and a descriptor reopened under the same number
+    // isn't registered - the other way round, a duplicate keeps it registered
+    if (errno != ENOENT && errno != EEXIST) {
+      return -1;
+    }
+    op = (errno == ENOENT) ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epollFd, op, fd, &event) < 0) {
+      return -1;
+    }
+  }
+  waiters.registered = events;
+  return 0;
+}
+
+/**
+ * Makes all of waiters ready again.
+ */
+void IoPoller::wake(ThreadQueue &waiters, void (*ready)(Thread *)) {
+  while (!waiters.empty()) {
+    Thread *thread = waiters.popFront();
+    thread->ioFd = -1;
+    waiting--;
+    ready(thread);
+  }
+}
+
+/**
+ * Adds thread to the waiters of fd, until it is ready for events.
+ * @param thread a thread not waiting for any descriptor
+ * @param fd the descriptor
+ * @param events EPOLLIN to wait until fd is readable, EPOLLOUT until it is writable
+ * @return 0 on success, -1 with errno set if fd can't be waited for (EPERM for a regular file,
+ *         which is always ready).
+ * @throws std::bad_alloc if the waiters of fd could not be allocated
+ */
+int IoPoller::wait(Thread *thread, int fd, uint32_t events) {
+  if (epollFd < 0) {
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd < 0) {
+      return -1;
+    }
+  }
+  if (fd < 0) {
+    errno = EBADF;
+    return -1;
+  }
+
+  Waiters &waiters = waitersOf(fd);
+  ThreadQueue &queue = (events & EPOLLIN) ? waiters.readers : waiters.writers;
+  queue.pushBack(thread);
+  if (update(fd) < 0) {
+    queue.remove(thread);
+    return -1;
+  }
+  thread->ioFd = fd;
+  waiting++;
+  return 0;
+}
+
+/**
+ * Removes thread from the waiters of its descriptor, if it waits for one.
+ */
+void IoPoller::cancel(Thread *thread) {
+  if (thread->ioFd < 0) {
+    return;
+  }
+  thread->ioLink.queue->remove(thread);
+  update(thread->ioFd);
+  thread->ioFd = -1;
+  waiting--;
+}
+
+/**
+ * @return true iff no thread is waiting for a descriptor.
+ */
+bool IoPoller::empty() {
+  return waiting == 0;
+}
+
+/**
+ * Waits for the descriptors threads are waiting for, and passes the waiters of each one that
+ * is ready (or failed, or was hung up on) to ready.
+ * @param timeoutMillis how long to wait for one to be ready: 0 not to wait, -1 until one is
+ * @param ready called with each thread whose descriptor is ready
+ * @return the number of threads passed to ready, -1 with errno set if the poll failed
+ *         (EINTR if a signal interrupted it).
+ */
+int IoPoller::poll(int timeoutMillis, void (*ready)(Thread *)) {
+  if (waiting == 0) {
+    return 0;
+  }
+
+  struct epoll_event events[POLL_EVENTS];
+  int count = epoll_wait(epollFd, events, POLL_EVENTS, timeoutMillis);
+  if (count < 0) {
+    return -1;
+  }
+
+  size_t before = waiting;
+  for (int i = 0; i < count; i++) {
+    int fd = events[i].data.fd;
+    Waiters &waiters = *fds[fd];
+    if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+      wake(waiters.readers, ready);
+    }
+    if (events[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) {
+      wake(waiters.writers, ready);
+    }
+    update(fd);
+  }
+  return (int) (before - waiting);
+}
+
+/**
+ * Closes the epoll instance, and forgets the waiters.
+ */
+void IoPoller::close() {
+  for (Waiters *waiters : fds) {
+    if (waiters != nullptr) {
+      waiters->readers.clear();
+      waiters->writers.clear();
+      delete waiters;
+    }
+  }
+  fds.clear();
+  waiting = 0;
+  if (epollFd >= 0) {
+    ::close(epollFd);
+    epollFd = -1;
+  }
+}
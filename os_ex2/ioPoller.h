@@ -0,0 +1,53 @@
+#ifndef OS_EX2_IO_POLLER_H
+#define OS_EX2_IO_POLLER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "thread.h"
+
+/**
+ * The threads waiting for file descriptors to become readable or writable, on one epoll
+ * instance. A descriptor is registered for the directions it has waiters in, level triggered,
+ * so a poll wakes all the waiters of a direction that is ready, and they try their I/O again.
+ * A thread waits for one descriptor at a time, linked in its waiters through ioLink.
+ */
+class IoPoller {
+ private:
+  struct Waiters {
+    ThreadQueue readers{&Thread::ioLink};
+    ThreadQueue writers{&Thread::ioLink};
+    uint32_t registered = 0;  // the events the descriptor is registered for, 0 if it isn't
+  };
+
+  int epollFd = -1;              // opened by the first wait
+  std::vector<Waiters *> fds;    // indexed by descriptor, nullptr for one never waited for
+  size_t waiting = 0;            // threads in all the waiters
+
+  Waiters &waitersOf(int fd);
+
+  int update(int fd);
+
+  void wake(ThreadQueue &waiters, void (*ready)(Thread *));
+
+ public:
+  /**
+   * Destructor of IoPoller object - closes the epoll instance.
+   */
+  ~IoPoller();
+
+  //// waiting
+  int wait(Thread *thread, int fd, uint32_t events);
+
+  void cancel(Thread *thread);
+
+  bool empty();
+
+  //// polling
+  int poll(int timeoutMillis, void (*ready)(Thread *));
+
+  //// memory
+  void close();
+};
+
+#endif //OS_EX2_IO_POLLER_H
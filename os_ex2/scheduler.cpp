@@ -0,0 +1,248 @@
+#include "scheduler.h"
+
+#include <time.h>
+
+
+////===============================  Scheduler ======================================================
+
+/**
+ * @param config the options given to uthread_init_config
+ * @return a new scheduler of config's policy, nullptr if there is no such policy.
+ */
+Scheduler *Scheduler::create(const uthread_config *config) {
+  switch (config->policy) {
+    case UTHREAD_POLICY_RR:
+      return new RoundRobinScheduler();
+    case UTHREAD_POLICY_PRIORITY:
+      return new PriorityScheduler(config->aging_quantums == 0 ? UTHREAD_DEFAULT_AGING
+                                                               : config->aging_quantums);
+    case UTHREAD_POLICY_FAIR:
+      return new FairScheduler();
+    default:
+      return nullptr;
+  }
+}
+
+////===============================  RoundRobinScheduler ============================================
+
+RoundRobinScheduler::RoundRobinScheduler() : readyThreads(&Thread::runLink) {
+}
+
+void RoundRobinScheduler::enqueue(Thread *thread) {
+  readyThreads.pushBack(thread);
+}
+
+void RoundRobinScheduler::remove(Thread *thread) {
+  readyThreads.remove(thread);
+}
+
+Thread *RoundRobinScheduler::pickNext() {
+  return readyThreads.popFront();
+}
+
+bool RoundRobinScheduler::empty() {
+  return readyThreads.empty();
+}
+
+////===============================  PriorityScheduler ==============================================
+
+PriorityScheduler::Level::Level() : ThreadQueue(&Thread::runLink) {
+}
+
+/**
+ * @param agingQuantums decisions after which waiting threads move up, negative for never
+ */
+PriorityScheduler::PriorityScheduler(int agingQuantums) : nonEmpty(0), agingQuantums(agingQuantums),
+                                                          decisions(0) {
+}
+
+/**
+ * @return the priority whose queue thread is in, -1 if it is not ready.
+ */
+int PriorityScheduler::levelOf(Thread *thread) {
+  ThreadQueue *queue = thread->runLink.queue;
+  return (queue == nullptr) ? -1 : (int) (static_cast<Level *>(queue) - levels);
+}
+
+/**
+ * Moves the longest waiting thread of every priority but the most urgent up one priority.
+ */
+void PriorityScheduler::age() {
+  for (int level = 1; level < UTHREAD_PRIORITY_LEVELS; ++level) {
+    Thread *oldest = levels[level].popFront();
+    if (oldest == nullptr) {
+      continue;
+    }
+    if (levels[level].empty()) {
+      nonEmpty &= ~(1u << level);
+    }
+    levels[level - 1].pushBack(oldest);
+    nonEmpty |= 1u << (level - 1);
+  }
+}
+
+void PriorityScheduler::enqueue(Thread *thread) {
+  int level = thread->getPriority();
+  levels[level].pushBack(thread);
+  nonEmpty |= 1u << level;
+}
+
+void PriorityScheduler::remove(Thread *thread) {
+  int level = levelOf(thread);
+  if (level < 0) {
+    return;
+  }
+  levels[level].remove(thread);
+  if (levels[level].empty()) {
+    nonEmpty &= ~(1u << level);
+  }
+}
+
+Thread *PriorityScheduler::pickNext() {
+  if (agingQuantums > 0 && ++decisions >= agingQuantums) {
+    decisions = 0;
+    age();
+  }
+  if (nonEmpty == 0) {
+    return nullptr;
+  }
+  int level = __builtin_ctz(nonEmpty);
+  Thread *thread = levels[level].popFront();
+  if (levels[level].empty()) {
+    nonEmpty &= ~(1u << level);
+  }
+  return thread;
+}
+
+bool PriorityScheduler::empty() {
+  return nonEmpty == 0;
+}
+
+/**
+ * Moves a ready thread to the queue of its new priority.
+ */
+void PriorityScheduler::updated(Thread *thread) {
+  if (levelOf(thread) >= 0) {
+    remove(thread);
+    enqueue(thread);
+  }
+}
+
+////===============================  FairScheduler ==================================================
+
+/**
+ * @return the monotonic clock, in nanoseconds.
+ */
+static uint64_t nowNanos() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec;
+}
+
+FairScheduler::FairScheduler() : minRuntime(0), current(nullptr), startedAt(0) {
+  heap.reserve(MAX_THREAD_NUM);
+}
+
+/**
+ * @return true iff the thread at heap[i] runs before the one at heap[j].
+ */
+bool FairScheduler::before(int i, int j) {
+  return heap[i]->getVirtualRuntime() < heap[j]->getVirtualRuntime();
+}
+
+/**
+ * Puts thread at heap[i], and lets it know where it is.
+ */
+void FairScheduler::place(int i, Thread *thread) {
+  heap[i] = thread;
+  thread->readyIndex = i;
+}
+
+void FairScheduler::siftUp(int i) {
+  while (i > 0 && before(i, (i - 1) / 2)) {
+    Thread *parent = heap[(i - 1) / 2];
+    place((i - 1) / 2, heap[i]);
+    place(i, parent);
+    i = (i - 1) / 2;
+  }
+}
+
+void FairScheduler::siftDown(int i) {
+  int size = (int) heap.size();
+  while (true) {
+    int smallest = i;
+    int left = 2 * i + 1;
+    int right = left + 1;
+    if (left < size && before(left, smallest)) {
+      smallest = left;
+    }
+    if (right < size && before(right, smallest)) {
+      smallest = right;
+    }
+    if (smallest == i) {
+      return;
+    }
+    Thread *child = heap[smallest];
+    place(smallest, heap[i]);
+    place(i, child);
+    i = smallest;
+  }
+}
+
+void FairScheduler::enqueue(Thread *thread) {
+  if (thread->getVirtualRuntime() < minRuntime) {
+    thread->setVirtualRuntime(minRuntime);
+  }
+  heap.push_back(thread);
+  place((int) heap.size() - 1, thread);
+  siftUp((int) heap.size() - 1);
+}
+
+void FairScheduler::remove(Thread *thread) {
+  int i = thread->readyIndex;
+  if (i < 0) {
+    return;
+  }
+  Thread *last = heap.back();
+  heap.pop_back();
+  thread->readyIndex = -1;
+  if (i < (int) heap.size()) {
+    place(i, last);
+    siftUp(i);
+    siftDown(last->readyIndex);
+  }
+}
+
+Thread *FairScheduler::pickNext() {
+  if (heap.empty()) {
+    return nullptr;
+  }
+  Thread *thread = heap[0];
+  remove(thread);
+  if (thread->getVirtualRuntime() > minRuntime) {
+    minRuntime = thread->getVirtualRuntime();
+  }
+  return thread;
+}
+
+bool FairScheduler::empty() {
+  return heap.empty();
+}
+
+void FairScheduler::started(Thread *thread) {
+  current = thread;
+  startedAt = nowNanos();
+}
+
+/**
+ * Charges thread the time it ran since started(), scaled by its weight.
+ */
+void FairScheduler::stopped(Thread *thread) {
+  if (thread != current) {
+    return;
+  }
+  uint64_t ran = nowNanos() - startedAt;
+  thread->setVirtualRuntime(thread->getVirtualRuntime() +
+                            ran * UTHREAD_DEFAULT_WEIGHT / (uint64_t) thread->getWeight());
+  current = nullptr;
+}
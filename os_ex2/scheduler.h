@@ -0,0 +1,156 @@
+#ifndef OS_EX2_SCHEDULER_H
+#define OS_EX2_SCHEDULER_H
+
+#include <stdint.h>
+#include <vector>
+#include "thread.h"
+#include "threadQueue.h"
+#include "uthreads.h"
+
+/**
+ * The ready threads, and the policy choosing which of them runs next.
+ * None of the operations allocates, except when a FairScheduler outgrows its heap.
+ */
+class Scheduler {
+ public:
+  /**
+   * @param config the options given to uthread_init_config
+   * @return a new scheduler of config's policy, nullptr if there is no such policy.
+   */
+  static Scheduler *create(const uthread_config *config);
+
+  virtual ~Scheduler() = default;
+
+  //// ready threads
+  /**
+   * Adds a thread that became ready.
+   */
+  virtual void enqueue(Thread *thread) = 0;
+
+  /**
+   * Removes a ready thread that blocked or terminated. Does nothing if it is not ready.
+   */
+  virtual void remove(Thread *thread) = 0;
+
+  /**
+   * Removes the thread to run next.
+   * @return the thread, nullptr if none is ready.
+   */
+  virtual Thread *pickNext() = 0;
+
+  virtual bool empty() = 0;
+
+  //// notifications
+  /**
+   * The priority or weight of thread changed.
+   */
+  virtual void updated(Thread *) {
+  }
+
+  /**
+   * thread starts running.
+   */
+  virtual void started(Thread *) {
+  }
+
+  /**
+   * thread stops running - may be called more than once.
+   */
+  virtual void stopped(Thread *) {
+  }
+};
+
+/**
+ * Round robin: one FIFO queue.
+ */
+class RoundRobinScheduler : public Scheduler {
+ private:
+  ThreadQueue readyThreads;
+
+ public:
+  RoundRobinScheduler();
+
+  void enqueue(Thread *thread) override;
+
+  void remove(Thread *thread) override;
+
+  Thread *pickNext() override;
+
+  bool empty() override;
+};
+
+/**
+ * Strict priority: a FIFO queue per priority, and a bit mask of the non-empty ones.
+ * Every agingQuantums decisions, the longest waiting thread of every priority but the
+ * most urgent moves up one priority. Only one thread per priority moves each time, so a
+ * thread with at most k threads ahead of it at every priority waits
+ * O(k * priority * agingQuantums) decisions at most.
+ * A thread goes back to its own priority when it is enqueued again.
+ */
+class PriorityScheduler : public Scheduler {
+ private:
+  struct Level : ThreadQueue {
+    Level();
+  };
+
+  Level levels[UTHREAD_PRIORITY_LEVELS];
+  uint32_t nonEmpty;  // bit i is set iff levels[i] has threads
+  int agingQuantums;  // negative for no aging
+  int decisions;
+
+  int levelOf(Thread *thread);
+
+  void age();
+
+ public:
+  explicit PriorityScheduler(int agingQuantums);
+
+  void enqueue(Thread *thread) override;
+
+  void remove(Thread *thread) override;
+
+  Thread *pickNext() override;
+
+  bool empty() override;
+
+  void updated(Thread *thread) override;
+};
+
+/**
+ * Weighted fair queuing: a min heap of the ready threads by virtual runtime.
+ * A running thread is charged the time it ran, times UTHREAD_DEFAULT_WEIGHT / weight.
+ * A thread becoming ready gets at least the least virtual runtime of the ready threads, so
+ * sleeping doesn't bank time to starve the others with later.
+ */
+class FairScheduler : public Scheduler {
+ private:
+  std::vector<Thread *> heap;
+  uint64_t minRuntime;     // least virtual runtime seen at the top of the heap
+  Thread *current;         // the thread being timed, nullptr if none
+  uint64_t startedAt;      // when current started running, in nanoseconds
+
+  bool before(int i, int j);
+
+  void place(int i, Thread *thread);
+
+  void siftUp(int i);
+
+  void siftDown(int i);
+
+ public:
+  FairScheduler();
+
+  void enqueue(Thread *thread) override;
+
+  void remove(Thread *thread) override;
+
+  Thread *pickNext() override;
+
+  bool empty() override;
+
+  void started(Thread *thread) override;
+
+  void stopped(Thread *thread) override;
+};
+
+#endif //OS_EX2_SCHEDULER_H
@@ -1,10 +1,12 @@
 /**********************************************
- * Test 132: thread's signal mask is saved between switches (not including VTALRM)
+ * Test 132: the signal mask is shared by the threads - a switch keeps it (and VTALRM unblocked)
  *
  * steps:
- * create three global sets of different signals (not including VTALRM) - set1, set2, set3
- * spawn threads 1,2,3
- * each thread K blocks setK and infinitely checks that his sigmask is setK
+ * create two global sets of different signals (not including VTALRM) - set1, set2
+ * the main thread blocks set1, and spawns threads 1,2,3
+ * each thread checks that the sigmask is set1, switching by block/resume and by the timer
+ * the main thread then replaces the mask with set2: threads 1,2,3, preempted by the timer
+ * meanwhile, and a new thread check that they see set2
  *
  **********************************************/
 
@@ -26,10 +28,13 @@
 
 #define RUN 0
 #define DONE 1
+#define REPLACED 2
 
-sigset_t set1, set2, set3;
+sigset_t set1, set2;
 
-char thread_status[NUM_THREADS];
+volatile char thread_status[NUM_THREADS];
+volatile bool replaced = false;
+volatile bool replaced_checked = false;
 
 void halt()
 {
@@ -38,80 +43,77 @@ void halt()
 }
 
 
-int next_thread()
+bool same_mask(const sigset_t& expected, const sigset_t& actual)
 {
-    return (uthread_get_tid() + 1) % NUM_THREADS;
+    for (int sig = 1; sig < NSIG; sig++)
+    {
+        if (sigismember(&expected, sig) != sigismember(&actual, sig))
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
 void check_sig_mask(const sigset_t& expected)
+{
+    sigset_t actual;
+    sigprocmask(0, NULL, &actual);
+    if (!same_mask(expected, actual) || sigismember(&actual, SIGVTALRM))
+    {
+        printf(RED "ERROR - sigmask changed\n" RESET);
+        exit(1);
+    }
+}
+
+void check_sig_mask_across_switches(const sigset_t& expected)
 {
     for (unsigned int i = 0; i <= 20; i++)
     {
-        sigset_t actual;
-        sigprocmask(0, NULL, &actual);
-//        std::cout << "check_sig_mask\n";
-        if (memcmp(&expected, &actual, sizeof(sigset_t)) != 0)
-        {
-            printf(RED "ERROR - sigmask changed\n" RESET);
-            exit(1);
-        }
+        check_sig_mask(expected);
 
-        // in the first 10 iterations let the thread stop because of sync / block.
+        // in the first 10 iterations let the thread stop because of block.
         // in later iterations it will stop because of the timer
-//        if (i < 5)
-//        {
-//            uthread_sync(next_thread());
-//        }
-//        else if (i < 10)
         if (i < 10)
         {
-            std::cout << "i<10\n";
             uthread_block(uthread_get_tid());
         }
         else
         {
-            std::cout << "i>=10\n";
             int quantum = uthread_get_quantums(uthread_get_tid());
             while (uthread_get_quantums(uthread_get_tid()) == quantum)
             {}
         }
     }
     thread_status[uthread_get_tid()] = DONE;
-    std::cout << "csm about to halt\n";
+
+    // runs on only when the timer preempts main, so it resumes from the timer's handler
+    while (!replaced)
+    {}
+    check_sig_mask(set2);
+    thread_status[uthread_get_tid()] = REPLACED;
     halt();
 }
 
-void thread1()
+void thread_shared()
 {
-//    std::cout << "thread1\n";
-    sigprocmask(SIG_BLOCK, &set1, NULL);
-    check_sig_mask(set1);
+    check_sig_mask_across_switches(set1);
 }
 
-void thread2()
+void thread_replaced()
 {
-//    std::cout << "thread2\n";
-    sigprocmask(SIG_BLOCK, &set2, NULL);
     check_sig_mask(set2);
+    replaced_checked = true;
+    halt();
 }
 
-void thread3()
-{
-//    std::cout << "thread3\n";
-    sigprocmask(SIG_BLOCK, &set3, NULL);
-    check_sig_mask(set3);
-}
-
-bool all_done()
+bool all_reached(char status)
 {
-//    std::cout << "all_done\n";
     bool res = true;
     for (int i = 1; i < NUM_THREADS; i++)
     {
-        std::cout << "i=" << i << "\n";
-        res = res && (thread_status[i] == DONE);
+        res = res && (thread_status[i] >= status);
     }
-    std::cout << "res is:" << res << "\n";
     return res;
 }
 
@@ -122,7 +124,6 @@ int main()
 
     sigemptyset(&set1);
     sigemptyset(&set2);
-    sigemptyset(&set3);
 
     sigaddset(&set1, SIGBUS);
     sigaddset(&set1, SIGTERM);
@@ -130,14 +131,9 @@ int main()
     sigaddset(&set1, SIGABRT);
 
     sigaddset(&set2, SIGUSR1);
-    sigaddset(&set2, SIGSEGV);
     sigaddset(&set2, SIGUSR2);
     sigaddset(&set2, SIGPIPE);
-
-    sigaddset(&set3, SIGTSTP);
-    sigaddset(&set3, SIGTTIN);
-    sigaddset(&set3, SIGTTOU);
-    sigaddset(&set3, SIGBUS);
+    sigaddset(&set2, SIGTTIN);
 
     uthread_init(50);
 
@@ -146,9 +142,10 @@ int main()
         thread_status[i] = RUN;
     }
 
-    int t1 = uthread_spawn(thread1);
-    int t2 = uthread_spawn(thread2);
-    int t3 = uthread_spawn(thread3);
+    sigprocmask(SIG_BLOCK, &set1, NULL);
+    int t1 = uthread_spawn(thread_shared);
+    int t2 = uthread_spawn(thread_shared);
+    int t3 = uthread_spawn(thread_shared);
 
     if (t1 == -1 || t2 == -1 || t3 == -1)
     {
@@ -156,17 +153,29 @@ int main()
         exit(1);
     }
 
-
     int tid = 0;
-    std::cout << "before !all_done loop\n";
-    while (!all_done())
+    while (!all_reached(DONE))
     {
         // resume all threads, as each one of them is blocking himself
-        std::cout << "tid:" << tid <<"\n";
+        check_sig_mask(set1);
         uthread_resume(tid);
         tid = (tid + 1) % NUM_THREADS;
     }
 
+    // a mask the main thread sets is the one the next threads run with - those preempted by
+    // the timer with the old one too
+    sigprocmask(SIG_SETMASK, &set2, NULL);
+    replaced = true;
+    while (!all_reached(REPLACED))
+    {}
+    int t4 = uthread_spawn(thread_replaced);
+    if (t4 == -1)
+    {
+        printf(RED "ERROR - threads spawning failed\n" RESET);
+        exit(1);
+    }
+    while (!replaced_checked)
+    {}
 
     printf(GRN "SUCCESS\n" RESET);
     uthread_terminate(0);
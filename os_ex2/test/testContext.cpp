@@ -0,0 +1,265 @@
+/**********************************************
+ * Test context: what a switch must keep
+ *
+ * steps:
+ * switchContext into a fresh context: it starts with the default MXCSR and x87 control word
+ * callee-saved registers, MXCSR and the x87 control word survive switching away and back,
+ * though the other context changed them all
+ * errno survives a thread yielding and being preempted, though another thread sets it
+ *
+ * Builds as 64 bit, and as 32 bit with -m32.
+ *
+ **********************************************/
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <stdint.h>
+#include "uthreads.h"
+#include "context.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define ROUNDS 100
+#define CONTEXT_STACK 65536
+
+#define DEFAULT_MXCSR 0x1f80
+#define DEFAULT_FPU_CW 0x037f
+#define MAIN_MXCSR 0x7f80   /* round towards zero */
+#define MAIN_FPU_CW 0x0c7f  /* round towards zero, single precision */
+#define OTHER_MXCSR 0x3f80  /* round down */
+#define OTHER_FPU_CW 0x047f /* round down */
+
+#ifdef __x86_64__
+#define SAVED_REGISTERS 6 /* rbx, rbp, r12, r13, r14, r15 */
+#else
+#define SAVED_REGISTERS 4 /* ebx, esi, edi, ebp */
+#endif
+
+/*
+ * switchWith(save, load, pattern, after) fills the callee-saved registers with pattern + 1,
+ * pattern + 2, ..., calls switchContext(save, load), and stores the registers it finds once
+ * switched back in after - then restores the caller's registers and returns.
+ */
+extern "C" void switchWith(Context *save, Context load, uintptr_t pattern, uintptr_t *after);
+
+#ifdef __x86_64__
+asm(".text\n"
+    ".globl switchWith\n"
+    ".type switchWith, @function\n"
+    "switchWith:\n"
+    "  pushq %rbp\n"
+    "  pushq %rbx\n"
+    "  pushq %r12\n"
+    "  pushq %r13\n"
+    "  pushq %r14\n"
+    "  pushq %r15\n"
+    "  pushq %rcx\n"
+    "  leaq 1(%rdx), %rbx\n"
+    "  leaq 2(%rdx), %rbp\n"
+    "  leaq 3(%rdx), %r12\n"
+    "  leaq 4(%rdx), %r13\n"
+    "  leaq 5(%rdx), %r14\n"
+    "  leaq 6(%rdx), %r15\n"
+    "  call switchContext\n"
+    "  popq %rcx\n"
+    "  movq %rbx, (%rcx)\n"
+    "  movq %rbp, 8(%rcx)\n"
+    "  movq %r12, 16(%rcx)\n"
+    "  movq %r13, 24(%rcx)\n"
+    "  movq %r14, 32(%rcx)\n"
+    "  movq %r15, 40(%rcx)\n"
+    "  popq %r15\n"
+    "  popq %r14\n"
+    "  popq %r13\n"
+    "  popq %r12\n"
+    "  popq %rbx\n"
+    "  popq %rbp\n"
+    "  ret\n"
+    ".size switchWith, .-switchWith\n");
+#else
+asm(".text\n"
+    ".globl switchWith\n"
+    ".type switchWith, @function\n"
+    "switchWith:\n"
+    "  pushl %ebp\n"
+    "  pushl %ebx\n"
+    "  pushl %esi\n"
+    "  pushl %edi\n"
+    "  movl 20(%esp), %eax\n"
+    "  movl 24(%esp), %edx\n"
+    "  movl 28(%esp), %ecx\n"
+    "  leal 1(%ecx), %ebx\n"
+    "  leal 2(%ecx), %esi\n"
+    "  leal 3(%ecx), %edi\n"
+    "  leal 4(%ecx), %ebp\n"
+    "  subl $4, %esp\n"
+    "  pushl %edx\n"
+    "  pushl %eax\n"
+    "  call switchContext\n"
+    "  addl $12, %esp\n"
+    "  movl 32(%esp), %ecx\n"
+    "  movl %ebx, (%ecx)\n"
+    "  movl %esi, 4(%ecx)\n"
+    "  movl %edi, 8(%ecx)\n"
+    "  movl %ebp, 12(%ecx)\n"
+    "  popl %edi\n"
+    "  popl %esi\n"
+    "  popl %ebx\n"
+    "  popl %ebp\n"
+    "  ret\n"
+    ".size switchWith, .-switchWith\n");
+#endif
+
+#define MAIN_PATTERN ((uintptr_t) 0x5a5a5a50)
+#define OTHER_PATTERN ((uintptr_t) 0x3c3c3c30)
+
+Context mainContext;
+Context otherContext;
+char otherStack[CONTEXT_STACK] __attribute__((aligned(16)));
+
+volatile int otherErrno = 0;
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+unsigned int getMxcsr()
+{
+    unsigned int mxcsr = 0;
+    asm volatile("stmxcsr %0" : "=m"(mxcsr));
+    return mxcsr;
+}
+
+void setMxcsr(unsigned int mxcsr)
+{
+    asm volatile("ldmxcsr %0" : : "m"(mxcsr));
+}
+
+unsigned short getFpuCw()
+{
+    unsigned short cw = 0;
+    asm volatile("fnstcw %0" : "=m"(cw));
+    return cw;
+}
+
+void setFpuCw(unsigned short cw)
+{
+    asm volatile("fldcw %0" : : "m"(cw));
+}
+
+void checkRegisters(const uintptr_t *after, uintptr_t pattern, const char *message)
+{
+    for (int i = 0; i < SAVED_REGISTERS; i++)
+    {
+        if (after[i] != pattern + i + 1)
+        {
+            error(message);
+        }
+    }
+}
+
+/* Runs in the fresh context: checks its start, then trashes everything and switches back. */
+void other()
+{
+    if (getMxcsr() != DEFAULT_MXCSR || getFpuCw() != DEFAULT_FPU_CW)
+    {
+        error("a new context did not start with the default control words");
+    }
+    uintptr_t after[SAVED_REGISTERS];
+    while (true)
+    {
+        setMxcsr(OTHER_MXCSR);
+        setFpuCw(OTHER_FPU_CW);
+        switchWith(&otherContext, mainContext, OTHER_PATTERN, after);
+        checkRegisters(after, OTHER_PATTERN, "registers of the other context changed");
+        if (getMxcsr() != OTHER_MXCSR || getFpuCw() != OTHER_FPU_CW)
+        {
+            error("control words of the other context changed");
+        }
+    }
+}
+
+void testSwitchContext()
+{
+    otherContext = makeContext(otherStack + CONTEXT_STACK, other);
+
+    unsigned int mxcsr = getMxcsr();
+    unsigned short cw = getFpuCw();
+    uintptr_t after[SAVED_REGISTERS];
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        setMxcsr(MAIN_MXCSR);
+        setFpuCw(MAIN_FPU_CW);
+        switchWith(&mainContext, otherContext, MAIN_PATTERN, after);
+        checkRegisters(after, MAIN_PATTERN, "callee-saved registers changed across a switch");
+        if (getMxcsr() != MAIN_MXCSR)
+        {
+            error("MXCSR changed across a switch");
+        }
+        if (getFpuCw() != MAIN_FPU_CW)
+        {
+            error("x87 control word changed across a switch");
+        }
+    }
+    setMxcsr(mxcsr);
+    setFpuCw(cw);
+}
+
+/* Keeps setting its own errno, so the others' would be lost if a switch didn't keep it. */
+void errnoSetter()
+{
+    while (true)
+    {
+        errno = EAGAIN;
+        otherErrno++;
+        uthread_yield();
+    }
+}
+
+void testErrno()
+{
+    uthread_init(1000);
+    if (uthread_spawn(errnoSetter) == -1)
+    {
+        error("spawn failed");
+    }
+
+    // yielding
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        errno = EINTR;
+        uthread_yield();
+        if (errno != EINTR)
+        {
+            error("errno changed across a yield");
+        }
+    }
+
+    // preempted by the timer
+    int runs = otherErrno;
+    errno = ENOENT;
+    while (otherErrno < runs + ROUNDS)
+    {
+        if (errno != ENOENT)
+        {
+            error("errno changed across a preemption");
+        }
+    }
+}
+
+int main()
+{
+    printf(GRN "Test context: " RESET);
+    fflush(stdout);
+
+    testSwitchContext();
+    testErrno();
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
@@ -0,0 +1,212 @@
+/**********************************************
+ * Test I/O: uthread_read, uthread_write and uthread_accept
+ *
+ * steps:
+ * before uthread_init, reading an empty pipe fails with EAGAIN instead of waiting
+ * a thread reading an empty pipe waits, while the others run on
+ * once every thread waits for a pipe, the process sleeps until one is ready
+ * a thread blocked while waiting for a pipe runs only once resumed, however ready the pipe
+ * an echo server with a thread per connection serves many clients, all on blocking calls
+ * I/O on a bad descriptor fails as the system call does
+ *
+ **********************************************/
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define QUANTUM 10000
+#define CLIENTS 20
+
+int request[2], reply[2];
+volatile int started = 0;
+volatile int echoed = 0;
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void readerThread()
+{
+    char c;
+    started = 1;
+    if (uthread_read(request[0], &c, 1) != 1)
+    {
+        error("read from a pipe failed");
+    }
+    c++;
+    if (uthread_write(reply[1], &c, 1) != 1)
+    {
+        error("write to a pipe failed");
+    }
+    uthread_terminate(uthread_get_tid());
+}
+
+//// echo server
+
+int listener;
+sockaddr_in address;
+int connections[MAX_THREAD_NUM];
+int done[2];
+
+void handlerThread()
+{
+    int fd = connections[uthread_get_tid()];
+    char buf[64];
+    ssize_t n;
+    while ((n = uthread_read(fd, buf, sizeof(buf))) > 0)
+    {
+        if (uthread_write(fd, buf, (size_t) n) != n)
+        {
+            error("echo failed");
+        }
+    }
+    close(fd);
+    uthread_terminate(uthread_get_tid());
+}
+
+void acceptThread()
+{
+    for (int i = 0; i < CLIENTS; i++)
+    {
+        int fd = uthread_accept(listener, nullptr, nullptr);
+        if (fd < 0)
+        {
+            error("accept failed");
+        }
+        int tid = uthread_spawn(handlerThread);
+        connections[tid] = fd;
+    }
+    uthread_terminate(uthread_get_tid());
+}
+
+void clientThread()
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (sockaddr *) &address, sizeof(address)) < 0)
+    {
+        error("connect failed");
+    }
+    int tid = uthread_get_tid();
+    for (int round = 0; round < 10; round++)
+    {
+        int message = tid * 100 + round;
+        int answer = 0;
+        if (uthread_write(fd, &message, sizeof(message)) != sizeof(message) ||
+            uthread_read(fd, &answer, sizeof(answer)) != sizeof(answer) || answer != message)
+        {
+            error("wrong echo");
+        }
+    }
+    close(fd);
+    echoed++;
+    if (echoed == CLIENTS)
+    {
+        char c = 0;
+        uthread_write(done[1], &c, 1);
+    }
+    uthread_terminate(uthread_get_tid());
+}
+
+int main()
+{
+    printf(GRN "Test I/O: " RESET);
+    fflush(stdout);
+
+    if (pipe(request) < 0 || pipe(reply) < 0 || pipe(done) < 0)
+    {
+        error("pipe failed");
+    }
+
+    // no thread to block yet
+    char byte;
+    if (uthread_read(request[0], &byte, 1) != -1 || errno != EAGAIN)
+    {
+        error("read before init did not fail with EAGAIN");
+    }
+
+    uthread_init(QUANTUM);
+
+    // the reader waits, main runs on
+    int reader = uthread_spawn(readerThread);
+    while (!started)
+    {}
+    int quantums = uthread_get_quantums(reader);
+    int start = uthread_get_total_quantums();
+    while (uthread_get_total_quantums() < start + 5)
+    {}
+    if (uthread_get_quantums(reader) != quantums)
+    {
+        error("a thread waiting for a pipe ran");
+    }
+
+    // main waits for the reply, and the reader for the request: the process sleeps in epoll
+    char c = 'a';
+    uthread_write(request[1], &c, 1);
+    if (uthread_read(reply[0], &c, 1) != 1 || c != 'b')
+    {
+        error("wrong reply through the pipes");
+    }
+
+    // blocked while waiting
+    reader = uthread_spawn(readerThread);
+    started = 0;
+    while (!started)
+    {}
+    uthread_block(reader);
+    c = 'x';
+    uthread_write(request[1], &c, 1);
+    start = uthread_get_total_quantums();
+    while (uthread_get_total_quantums() < start + 5)
+    {}
+    if (uthread_get_quantums(reader) != 1)
+    {
+        error("a blocked thread ran once its pipe was ready");
+    }
+    uthread_resume(reader);
+    if (uthread_read(reply[0], &c, 1) != 1 || c != 'y')
+    {
+        error("a resumed thread did not read its pipe");
+    }
+
+    // echo server
+    listener = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    if (listener < 0 || bind(listener, (sockaddr *) &address, sizeof(address)) < 0 ||
+        getsockname(listener, (sockaddr *) &address, &length) < 0 || listen(listener, CLIENTS) < 0)
+    {
+        error("listen failed");
+    }
+    uthread_spawn(acceptThread);
+    for (int i = 0; i < CLIENTS; i++)
+    {
+        uthread_spawn(clientThread);
+    }
+    if (uthread_read(done[0], &c, 1) != 1 || echoed != CLIENTS)
+    {
+        error("the clients were not all served");
+    }
+
+    // bad descriptor
+    if (uthread_read(-1, &c, 1) != -1 || errno != EBADF)
+    {
+        error("read from a bad descriptor did not fail with EBADF");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
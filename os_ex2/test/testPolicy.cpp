@@ -0,0 +1,185 @@
+/**********************************************
+ * Test policy: priority and weighted fair scheduling
+ *
+ * steps:
+ * (child) an unknown policy fails to init
+ * (child) under PRIORITY without aging, ready threads run most urgent first, and a thread
+ *         less urgent than main runs only once main drops to its priority
+ * (child) under PRIORITY with aging, that thread runs while main stays more urgent
+ * (child) under FAIR, a thread of 3 times the weight runs about 3 times as many quantums
+ * bad priorities, weights and quanta are errors
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define QUANTUM 10000
+#define FAIR_QUANTUMS 150
+
+char order[4];
+volatile int ran = 0;
+
+void halt()
+{
+    while (true)
+    {}
+}
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void record(char name)
+{
+    order[ran] = name;
+    ran++;
+    uthread_terminate(uthread_get_tid());
+}
+
+void urgent()
+{
+    record('u');
+}
+
+void normal()
+{
+    record('n');
+}
+
+void idle()
+{
+    record('i');
+}
+
+void unknownPolicy()
+{
+    uthread_config config{};
+    config.policy = (uthread_policy) 7;
+    if (uthread_init_config(QUANTUM, &config) != -1)
+    {
+        error("init succeeded with an unknown policy");
+    }
+    exit(0);
+}
+
+void strictPriority()
+{
+    uthread_config config{};
+    config.policy = UTHREAD_POLICY_PRIORITY;
+    config.aging_quantums = -1;
+    uthread_init_config(QUANTUM, &config);
+
+    uthread_set_priority(uthread_spawn(idle), UTHREAD_PRIORITY_LEVELS - 1);
+    uthread_spawn(normal);
+    uthread_set_priority(uthread_spawn(urgent), 0);
+
+    while (ran < 2)
+    {}
+    // main is more urgent than idle, which never runs while main is ready
+    int start = uthread_get_total_quantums();
+    while (uthread_get_total_quantums() < start + 10)
+    {}
+    if (ran != 2 || order[0] != 'u' || order[1] != 'n')
+    {
+        error("threads did not run most urgent first");
+    }
+
+    uthread_set_priority(0, UTHREAD_PRIORITY_LEVELS - 1);
+    while (ran < 3)
+    {}
+    uthread_terminate(0);
+}
+
+void aging()
+{
+    uthread_config config{};
+    config.policy = UTHREAD_POLICY_PRIORITY;
+    uthread_init_config(QUANTUM, &config);
+
+    uthread_set_priority(0, 0);
+    uthread_set_priority(uthread_spawn(idle), UTHREAD_PRIORITY_LEVELS - 1);
+    while (ran < 1)
+    {}
+    uthread_terminate(0);
+}
+
+int heavyTid, lightTid;
+
+void fair()
+{
+    uthread_config config{};
+    config.policy = UTHREAD_POLICY_FAIR;
+    uthread_init_config(QUANTUM, &config);
+
+    heavyTid = uthread_spawn(halt);
+    lightTid = uthread_spawn(halt);
+    uthread_set_weight(heavyTid, 3 * UTHREAD_DEFAULT_WEIGHT);
+
+    while (uthread_get_total_quantums() < FAIR_QUANTUMS)
+    {}
+    double ratio = (double) uthread_get_quantums(heavyTid) / uthread_get_quantums(lightTid);
+    if (ratio < 2 || ratio > 4.5)
+    {
+        error("quantums not in proportion to the weights");
+    }
+    uthread_terminate(0);
+}
+
+void inChild(void (*f)(void), const char *failure)
+{
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        f();
+        exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        error(failure);
+    }
+}
+
+int main()
+{
+    printf(GRN "Test policy: " RESET);
+    fflush(stdout);
+
+    fprintf(stderr, "(errors about bad arguments are expected) ");
+    inChild(unknownPolicy, "unknown policy");
+    inChild(strictPriority, "strict priority");
+    inChild(aging, "aging");
+    inChild(fair, "weighted fair queuing");
+
+    uthread_init(QUANTUM);
+    if (uthread_set_priority(0, UTHREAD_PRIORITY_LEVELS) != -1 || uthread_set_priority(0, -1) != -1)
+    {
+        error("set a priority out of range");
+    }
+    if (uthread_set_weight(0, 0) != -1)
+    {
+        error("set a non-positive weight");
+    }
+    if (uthread_set_quantum(0, -1) != -1 || uthread_set_quantum(1, QUANTUM) != -1)
+    {
+        error("set a bad quantum");
+    }
+    if (uthread_set_quantum(0, 2 * QUANTUM) != 0 || uthread_set_quantum(0, 0) != 0)
+    {
+        error("failed to set a quantum");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
@@ -0,0 +1,104 @@
+/**********************************************
+ * Test pool: threads and stacks are reused after termination
+ *
+ * steps:
+ * a driver thread spawns many generations of threads, with both the default and
+ * a custom stack size. Half of them terminate themselves, and the driver
+ * terminates the other half. Every thread must run on a stack that works, and
+ * spawning must keep working (a leak would hit MAX_THREAD_NUM).
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define GENERATIONS 200
+#define NUM_THREADS 10
+#define CUSTOM_STACK (64 * 1024)
+
+int ran[MAX_THREAD_NUM];
+volatile int finished = 0;
+bool done = false;
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void useStack()
+{
+    volatile char frame[1024];
+    memset((char *) frame, uthread_get_tid(), sizeof(frame));
+    ran[uthread_get_tid()] += frame[sizeof(frame) - 1] == uthread_get_tid();
+    finished++;
+}
+
+void selfTerminating()
+{
+    useStack();
+    uthread_terminate(uthread_get_tid());
+}
+
+void blocking()
+{
+    useStack();
+    uthread_block(uthread_get_tid());
+}
+
+// spawns the workers of every generation, and waits for them
+void driver()
+{
+    int tids[NUM_THREADS];
+    for (int generation = 0; generation < GENERATIONS; generation++)
+    {
+        finished = 0;
+        for (int i = 0; i < NUM_THREADS; i++)
+        {
+            tids[i] = (i % 2 == 0) ? uthread_spawn(selfTerminating) :
+                      uthread_spawn_stack(blocking, CUSTOM_STACK);
+            if (tids[i] == -1)
+            {
+                error("spawn failed");
+            }
+            ran[tids[i]] = 0;
+        }
+
+        while (finished < NUM_THREADS)
+        {}
+
+        for (int i = 0; i < NUM_THREADS; i++)
+        {
+            if (ran[tids[i]] != 1)
+            {
+                error("thread did not run on a working stack");
+            }
+            if (i % 2 == 1 && uthread_terminate(tids[i]) != 0)
+            {
+                error("terminate failed");
+            }
+        }
+    }
+    done = true;
+    uthread_block(uthread_get_tid());
+}
+
+int main()
+{
+    printf(GRN "Test pool:  " RESET);
+    fflush(stdout);
+
+    uthread_init(100);
+    uthread_spawn(driver);
+    while (!done)
+    {}
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
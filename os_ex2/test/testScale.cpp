@@ -0,0 +1,87 @@
+/**********************************************
+ * Test scale: many more threads than MAX_THREAD_NUM
+ *
+ * steps:
+ * init with a limit of NUM_THREADS + 1 threads, recent-first tids and unguarded stacks
+ * spawn NUM_THREADS threads - the next spawn must fail
+ * every thread runs once, and terminates itself, in turn
+ * the freed tids are given again, most recently freed first
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define NUM_THREADS 40000
+
+volatile int finished = 0;
+char ran[NUM_THREADS + 1];
+
+void halt()
+{
+    while (true)
+    {}
+}
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void thread()
+{
+    ran[uthread_get_tid()]++;
+    finished++;
+    uthread_terminate(uthread_get_tid());
+}
+
+int main()
+{
+    printf(GRN "Test scale: " RESET);
+    fflush(stdout);
+
+    uthread_config config{};
+    config.max_threads = NUM_THREADS + 1;
+    config.tid_order = UTHREAD_TID_RECENT;
+    config.unguarded_stacks = 1;
+    // a long quantum, so main spawns them all before any runs
+    uthread_init_config(1000000, &config);
+
+    for (int i = 1; i <= NUM_THREADS; i++)
+    {
+        if (uthread_spawn(thread) != i)
+        {
+            error("wrong id returned");
+        }
+    }
+    fprintf(stderr, "(an error about the thread limit is expected) ");
+    if (uthread_spawn(thread) != -1)
+    {
+        error("spawned beyond the thread limit");
+    }
+
+    while (finished < NUM_THREADS)
+    {}
+    for (int i = 1; i <= NUM_THREADS; i++)
+    {
+        if (ran[i] != 1)
+        {
+            error("thread did not run exactly once");
+        }
+    }
+
+    // main runs again only after the last of them terminated
+    if (uthread_spawn(halt) != NUM_THREADS)
+    {
+        error("tid of the most recently terminated thread was not reused");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
@@ -0,0 +1,104 @@
+/**********************************************
+ * Test stack: per-thread stack sizes and guard pages
+ *
+ * steps:
+ * a child process overflows the stack of a thread - it must exit with status 1
+ * spawning with a non-positive stack size fails
+ * a thread spawned with a large stack uses most of it
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define LARGE_STACK (1024 * 1024)
+#define LARGE_FRAME (768 * 1024)
+
+bool bigThreadDone = false;
+int maxDepth = 1 << 30; // far beyond any stack
+
+void halt()
+{
+    while (true)
+    {}
+}
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+int recurse(int depth)
+{
+    volatile char frame[256];
+    frame[0] = (char) depth;
+    if (depth == maxDepth)
+    {
+        return 0;
+    }
+    return recurse(depth + 1) + frame[0];
+}
+
+void overflowThread()
+{
+    recurse(0);
+}
+
+void bigThread()
+{
+    volatile char frame[LARGE_FRAME];
+    for (int i = 0; i < LARGE_FRAME; i += 4096)
+    {
+        frame[i] = 1;
+    }
+    bigThreadDone = frame[0] == 1;
+    uthread_terminate(uthread_get_tid());
+}
+
+int main()
+{
+    printf(GRN "Test stack: " RESET);
+    fflush(stdout);
+
+    pid_t child = fork();
+    if (child == 0)
+    {
+        // keep the expected error message out of the test output
+        freopen("/dev/null", "w", stderr);
+        uthread_init(100);
+        uthread_spawn(overflowThread);
+        halt();
+    }
+    int status;
+    if (child < 0 || waitpid(child, &status, 0) != child)
+    {
+        error("fork failed");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 1)
+    {
+        error("stack overflow was not reported");
+    }
+
+    uthread_init(100);
+    if (uthread_spawn_stack(bigThread, 0) != -1)
+    {
+        error("spawned a thread without a stack");
+    }
+    if (uthread_spawn_stack(bigThread, LARGE_STACK) != 1)
+    {
+        error("wrong id returned");
+    }
+    while (!bigThreadDone)
+    {}
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
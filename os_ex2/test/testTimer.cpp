@@ -0,0 +1,186 @@
+/**********************************************
+ * Test timer: uthread_sleep_usecs and time limits
+ *
+ * steps:
+ * main sleeping alone sleeps at least as long as asked, and not much longer
+ * thousands of threads sleeping for different times all wake, none early
+ * a thread blocked with a time limit runs again once it is over - or once resumed before
+ * a sync with a time limit gives up once it is over, and doesn't if the thread terminates first
+ * a sync isn't given up when the time limit of a block put on the synced thread is over
+ * a negative sleep is an error
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define QUANTUM 10000
+#define SLEEPERS 5000
+#define MAX_SLEEP_USECS 200000
+
+volatile int woken = 0;
+volatile int early = 0;
+volatile unsigned long counter = 0;
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+long long nowUsecs()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000LL + now.tv_nsec / 1000;
+}
+
+void sleeper()
+{
+    int usecs = (uthread_get_tid() * 7919) % MAX_SLEEP_USECS;
+    long long start = nowUsecs();
+    uthread_sleep_usecs(usecs);
+    if (nowUsecs() - start < usecs)
+    {
+        early++;
+    }
+    woken++;
+    uthread_terminate(uthread_get_tid());
+}
+
+void count()
+{
+    while (true)
+    {
+        counter++;
+    }
+}
+
+void napper()
+{
+    uthread_sleep_usecs(100000);
+    uthread_terminate(uthread_get_tid());
+}
+
+int countingTid, napperTid;
+volatile int gaveUp = -1, synced = -1;
+
+void syncer()
+{
+    gaveUp = uthread_sync_timeout(countingTid, 20000);
+    synced = uthread_sync_timeout(napperTid, 10000000);
+    uthread_terminate(uthread_get_tid());
+}
+
+volatile int plainSynced = -1;
+
+void plainSyncer()
+{
+    plainSynced = uthread_sync(napperTid);
+    uthread_terminate(uthread_get_tid());
+}
+
+int main()
+{
+    printf(GRN "Test timer: " RESET);
+    fflush(stdout);
+
+    uthread_config config{};
+    config.max_threads = -1;
+    config.unguarded_stacks = 1;
+    uthread_init_config(QUANTUM, &config);
+
+    // alone
+    long long start = nowUsecs();
+    uthread_sleep_usecs(50000);
+    long long slept = nowUsecs() - start;
+    if (slept < 50000 || slept > 150000)
+    {
+        error("main did not sleep as long as asked");
+    }
+
+    // many
+    for (int i = 0; i < SLEEPERS; i++)
+    {
+        if (uthread_spawn(sleeper) < 0)
+        {
+            error("spawn failed");
+        }
+    }
+    uthread_sleep_usecs(MAX_SLEEP_USECS + 100000);
+    if (woken != SLEEPERS || early != 0)
+    {
+        error("sleeping threads did not all wake, on time");
+    }
+
+    // block with a time limit
+    int counting = uthread_spawn(count);
+    uthread_sleep_usecs(20000);
+    uthread_block_timeout(counting, 100000);
+    unsigned long blocked = counter;
+    uthread_sleep_usecs(50000);
+    if (counter != blocked)
+    {
+        error("a thread blocked with a time limit ran before it was over");
+    }
+    uthread_sleep_usecs(100000);
+    if (counter == blocked)
+    {
+        error("a thread blocked with a time limit did not run once it was over");
+    }
+    uthread_block_timeout(counting, 50000);
+    uthread_resume(counting);
+    uthread_block(counting);
+    uthread_sleep_usecs(100000);
+    blocked = counter;
+    uthread_sleep_usecs(20000);
+    if (counter != blocked)
+    {
+        error("the time limit of a block ended a later one");
+    }
+
+    // sync with a time limit
+    countingTid = counting;
+    napperTid = uthread_spawn(napper);
+    uthread_spawn(syncer);
+    uthread_sleep_usecs(200000);
+    if (gaveUp != 1)
+    {
+        error("a sync with a time limit did not give up once it was over");
+    }
+    if (synced != 0)
+    {
+        error("a sync with a time limit gave up, or never ended");
+    }
+    uthread_terminate(counting);
+
+    // a block with a time limit, on a synced thread
+    napperTid = uthread_spawn(napper);
+    int plain = uthread_spawn(plainSyncer);
+    uthread_sleep_usecs(20000);
+    uthread_block_timeout(plain, 2000);
+    uthread_sleep_usecs(200000);
+    if (plainSynced != 0)
+    {
+        error("a sync returned other than 0 once the time limit of a block was over");
+    }
+
+    fprintf(stderr, "(errors about main syncing and a negative sleep are expected) ");
+    if (uthread_sync_timeout(uthread_spawn(count), 1000) != -1)
+    {
+        error("main synced");
+    }
+    if (uthread_sleep_usecs(-1) != -1)
+    {
+        error("slept a negative time");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
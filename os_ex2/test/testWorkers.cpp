@@ -0,0 +1,185 @@
+/**********************************************
+ * Test workers: M:N mode, uthreads on a pool of kernel threads
+ *
+ * steps:
+ * (child) with 4 workers, every busy thread gets to run
+ * (child) a thread blocked by another, maybe while running on another worker, stops running,
+ *         and runs again once resumed
+ * (child) a thread terminated while running on another worker stops, and its tid is free
+ * (child) a thread synced to another runs again once that one is terminated
+ * a negative number of workers is an error
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define WORKERS 4
+#define NUM_THREADS 8
+#define QUANTUM 10000
+#define PATIENCE (10 * CLOCKS_PER_SEC)
+
+volatile unsigned long counters[NUM_THREADS + 1];
+volatile int synced = 0;
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void spin(clock_t ticks)
+{
+    clock_t start = clock();
+    while (clock() - start < ticks)
+    {}
+}
+
+void count()
+{
+    int tid = uthread_get_tid();
+    while (true)
+    {
+        counters[tid]++;
+    }
+}
+
+void halt()
+{
+    while (true)
+    {}
+}
+
+int masterTid;
+
+void waiter()
+{
+    uthread_sync(masterTid);
+    synced = 1;
+    halt();
+}
+
+/** waits for *counter to differ from value, for long enough that every thread ran */
+void awaitChange(volatile unsigned long *counter, unsigned long value, const char *failure)
+{
+    clock_t start = clock();
+    while (*counter == value)
+    {
+        if (clock() - start > PATIENCE)
+        {
+            error(failure);
+        }
+    }
+}
+
+void workers()
+{
+    uthread_config config{};
+    config.workers = WORKERS;
+    if (uthread_init_config(QUANTUM, &config) != 0)
+    {
+        error("init with workers failed");
+    }
+
+    for (int i = 1; i <= NUM_THREADS; i++)
+    {
+        if (uthread_spawn(count) != i)
+        {
+            error("spawn failed");
+        }
+    }
+    for (int i = 1; i <= NUM_THREADS; i++)
+    {
+        awaitChange(&counters[i], 0, "a thread never ran");
+    }
+
+    // block and resume
+    uthread_block(1);
+    spin(CLOCKS_PER_SEC / 10);
+    unsigned long blocked = counters[1];
+    spin(CLOCKS_PER_SEC / 5);
+    if (counters[1] != blocked)
+    {
+        error("a blocked thread kept running");
+    }
+    uthread_resume(1);
+    awaitChange(&counters[1], blocked, "a resumed thread did not run again");
+
+    // terminate
+    uthread_terminate(2);
+    if (uthread_get_quantums(2) != -1)
+    {
+        error("a terminated thread still has a tid");
+    }
+    spin(CLOCKS_PER_SEC / 10);
+    unsigned long terminated = counters[2];
+    spin(CLOCKS_PER_SEC / 5);
+    if (counters[2] != terminated)
+    {
+        error("a terminated thread kept running");
+    }
+    if (uthread_spawn(count) != 2)
+    {
+        error("the tid of a terminated thread was not reused");
+    }
+
+    // sync
+    masterTid = uthread_spawn(halt);
+    int waiterTid = uthread_spawn(waiter);
+    while (uthread_get_quantums(waiterTid) == 0)
+    {}
+    spin(CLOCKS_PER_SEC / 10);
+    if (synced)
+    {
+        error("a synced thread ran on");
+    }
+    uthread_terminate(masterTid);
+    clock_t start = clock();
+    while (!synced)
+    {
+        if (clock() - start > PATIENCE)
+        {
+            error("a synced thread did not run again");
+        }
+    }
+    uthread_terminate(0);
+}
+
+int main()
+{
+    printf(GRN "Test workers: " RESET);
+    fprintf(stderr, "(errors about a terminated tid and the number of workers are expected) ");
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        workers();
+        exit(1);
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        error("M:N mode");
+    }
+
+    uthread_config config{};
+    config.workers = -1;
+    if (uthread_init_config(QUANTUM, &config) != -1)
+    {
+        error("init succeeded with a negative number of workers");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    return 0;
+}
@@ -0,0 +1,125 @@
+/**********************************************
+ * Test yield: cooperative switching and tickless mode
+ *
+ * steps:
+ * yielding alone keeps running in the same quantum
+ * threads yielding to each other run in turn, each yield starting a quantum
+ * (child) in tickless mode, main alone runs in one quantum, however long
+ * (child) once another thread is spawned, quanta end again
+ *
+ **********************************************/
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "uthreads.h"
+
+#define GRN "\e[32m"
+#define RED "\x1B[31m"
+#define RESET "\x1B[0m"
+
+#define NUM_THREADS 3
+#define ROUNDS 1000
+#define QUANTUM 10000
+
+int turn = 0;
+
+void halt()
+{
+    while (true)
+    {}
+}
+
+void error(const char *message)
+{
+    printf(RED "ERROR - %s\n" RESET, message);
+    exit(1);
+}
+
+void spin(clock_t ticks)
+{
+    clock_t start = clock();
+    while (clock() - start < ticks)
+    {}
+}
+
+void player()
+{
+    int tid = uthread_get_tid();
+    for (int i = 0; i < ROUNDS; i++)
+    {
+        if (turn % NUM_THREADS != tid)
+        {
+            error("threads did not yield in turn");
+        }
+        turn++;
+        uthread_yield();
+    }
+}
+
+void thread()
+{
+    player();
+    halt();
+}
+
+void tickless()
+{
+    uthread_config config{};
+    config.tickless = 1;
+    uthread_init_config(QUANTUM, &config);
+
+    spin(CLOCKS_PER_SEC / 5);
+    if (uthread_get_total_quantums() != 1)
+    {
+        error("quantum ended with a single thread in tickless mode");
+    }
+
+    uthread_spawn(halt);
+    spin(CLOCKS_PER_SEC / 5);
+    if (uthread_get_total_quantums() < 3)
+    {
+        error("quanta did not end once another thread was ready");
+    }
+    exit(0);
+}
+
+int main()
+{
+    printf(GRN "Test yield: " RESET);
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        tickless();
+    }
+    int status;
+    waitpid(pid, &status, 0);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        error("tickless mode");
+    }
+
+    // a long quantum, so only yields switch threads
+    uthread_init(1000000);
+    if (uthread_yield() != 0 || uthread_get_total_quantums() != 1)
+    {
+        error("yielding alone ended the quantum");
+    }
+
+    for (int i = 1; i < NUM_THREADS; i++)
+    {
+        uthread_spawn(thread);
+    }
+    player();
+    if (uthread_get_total_quantums() != 1 + NUM_THREADS * ROUNDS)
+    {
+        error("a yield did not start a quantum");
+    }
+
+    printf(GRN "SUCCESS\n" RESET);
+    uthread_terminate(0);
+}
@@ -1,74 +1,135 @@
 
 #include "thread.h"
 
+#include <new>
+#include <sys/mman.h>
+#include <unistd.h>
 
-////===========================================   processor stuff ==================================
-#ifdef __x86_64__
-/* code for 64 bit Intel arch */
 
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
+/**
+ * @return the size of a memory page, in bytes.
+ */
+static size_t pageSize() {
+  static const size_t size = (size_t) sysconf(_SC_PAGESIZE);
+  return size;
+}
 
-/* A translation is required when using an address of a variable.
-   Use this as a black box in your code. */
-address_t translate_address(address_t addr) {
-  address_t ret;
-  asm volatile("xor    %%fs:0x30,%0\n"
-      "rol    $0x11,%0\n"
-  : "=g" (ret)
-  : "0" (addr));
-  return ret;
+/**
+ * @return the stack space to keep on top of what a thread asked for, for the frame the kernel
+ * pushes when the preemption signal arrives, and the handler's own frames on top of it.
+ * The frame holds the extended register state, so it can be many KiB on recent processors.
+ */
+static size_t signalReserve() {
+  static size_t reserve = 0;
+  if (reserve == 0) {
+    size_t frame = MINSIGSTKSZ;
+#ifdef _SC_MINSIGSTKSZ
+    long kernelFrame = sysconf(_SC_MINSIGSTKSZ);
+    if (kernelFrame > 0) {
+      frame = (size_t) kernelFrame;
+    }
+#endif
+    reserve = frame + pageSize();
+  }
+  return reserve;
 }
 
-#else
-/* code for 32 bit Intel arch */
+/**
+ * @param stackSize bytes of stack a thread asks for
+ * @return the bytes of stack it gets: enlarged by the room a preemption signal takes, which
+ * the thread has no control over, and rounded up to whole pages.
+ */
+size_t Thread::stackSizeFor(size_t stackSize) {
+  size_t page = pageSize();
+  return (stackSize + signalReserve() + page - 1) / page * page;
+}
 
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
+/**
+ * Constructor of Thread object.
+ * The stack is mapped on its own, normally with a PROT_NONE guard page below it, so an
+ * overflow faults on the guard page instead of overwriting its neighbours.
+ * Without the guard page, the stacks of neighbouring threads merge into one mapping - a guarded
+ * stack takes two of the process's vm.max_map_count mappings, which caps the number of threads.
+ * @param tid the unique id of the new thread
+ * @param f pointer to function
+ * @param stackSize bytes of stack, as returned by stackSizeFor(). 0 for the main thread,
+ *        which runs on the process stack.
+ * @param guarded whether to put a guard page below the stack
+ * @throws std::bad_alloc if the stack could not be mapped
+ */
+Thread::Thread(int tid, void (*f)(void), size_t stackSize, bool guarded)
+    : dependantThreads(&Thread::syncLink) {
 
-/* A translation is required when using an address of a variable.
-   Use this as a black box in your code. */
-address_t translate_address(address_t addr)
-{
-    address_t ret;
-    asm volatile("xor    %%gs:0x18,%0\n"
-        "rol    $0x9,%0\n"
-                 : "=g" (ret)
-                 : "0" (addr));
-    return ret;
-}
+  tStack = nullptr;
+  tStackSize = stackSize;
+  tGuardSize = 0;
 
-#endif
-//// ========================================= END  processor stuff ================================
+  if (tStackSize != 0) {
+    tGuardSize = guarded ? pageSize() : 0;
+    void *mapping = mmap(nullptr, tGuardSize + tStackSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (mapping == MAP_FAILED) {
+      throw std::bad_alloc();
+    }
+    if (tGuardSize != 0 && mprotect(mapping, tGuardSize, PROT_NONE) < 0) {
+      munmap(mapping, tGuardSize + tStackSize);
+      throw std::bad_alloc();
+    }
+    tStack = (char *) mapping + tGuardSize;
+  }
 
+  reset(tid, f);
+}
 
 /**
- * Constructor of Thread object.
+ * Makes this object a new thread, keeping its stack - for reuse of terminated threads.
  * @param tid the unique id of the new thread
  * @param f pointer to function
  */
-Thread::Thread(int tid, void (*f)(void)) {
+void Thread::reset(int tid, void (*f)(void)) {
 
   this->tid = tid;
+  tEntry = f;
   tStatus = (tid == 0) ? running : ready;
 
   quantumRunningCounter = 0;
   isWaitingToResume = false;
   syncedTo = NOT_SYNCED;
-  auto sp = (address_t) this->tStack + STACK_SIZE - sizeof(address_t);
-  auto pc = (address_t) f;
-  sigsetjmp(tEnv, 1);
-  (tEnv->__jmpbuf)[JB_SP] = translate_address(sp);
-  (tEnv->__jmpbuf)[JB_PC] = translate_address(pc);
-  sigemptyset(&(tEnv->__saved_mask));
+  dependantThreads.clear();
+  priority = UTHREAD_DEFAULT_PRIORITY;
+  weight = UTHREAD_DEFAULT_WEIGHT;
+  virtualRuntime = 0;
+  quantumUsecs = 0;
+  readyIndex = -1;
+  readyWorker = -1;
+  ioFd = -1;
+  wakeTick = 0;
+  timeoutKind = sleeping;
+  syncTimedOut = false;
+  tContext = nullptr;
+  // a thread is switched to in a critical section - except main, which is already running
+  inCriticalSection = (tid == 0) ? 0 : 1;
+}
+
+/**
+ * Prepares the context of the thread to start at start, on a fresh stack.
+ * Does nothing for the main thread, whose context is saved when it first stops running.
+ * @param start the function the thread starts with - it must not return
+ */
+void Thread::prepareContext(void (*start)(void)) {
+  if (tStack != nullptr) {
+    tContext = makeContext(tStack + tStackSize, start);
+  }
 }
 
 /**
- * D-tor of Thread object.
+ * D-tor of Thread object - unmaps the stack.
  */
-Thread::~Thread() = default;
+Thread::~Thread() {
+  if (tStack != nullptr) {
+    munmap(tStack - tGuardSize, tGuardSize + tStackSize);
+  }
+}
 
 /**
  * @return the current threadId.
@@ -77,6 +138,13 @@ int Thread::getTid() {
   return this->tid;
 }
 
+/**
+ * @return the function the thread runs.
+ */
+void (*Thread::getEntry())(void) {
+  return tEntry;
+}
+
 /**
  * @return the current thread status.
  */
@@ -114,6 +182,21 @@ void Thread::unblockThread() {
   isWaitingToResume = false;
 }
 
+/**
+ * @return the usable bytes of stack of this thread (0 for the main thread).
+ */
+size_t Thread::getStackSize() {
+  return tStackSize;
+}
+
+/**
+ * @param addr a faulting address
+ * @return true iff addr lies in the guard page below this thread's stack.
+ */
+bool Thread::isGuardAddress(const void *addr) {
+  return (const char *) addr >= tStack - tGuardSize && (const char *) addr < tStack;
+}
+
 /**
  * @return the current thread total running time in quantum time-unit.
  */
@@ -146,14 +229,14 @@ int Thread::getSyncedTo() {
  * This method will add the given thread pointer to the dependants of this thread.
  * @param ptr thread pointer to insert as dependent.
  */
-void Thread::addToDependants(Thread *&ptr) {
-  dependantThreads.push_back(ptr);
+void Thread::addToDependants(Thread *ptr) {
+  dependantThreads.pushBack(ptr);
 }
 
 /**
  * @return the thread dependants.
  */
-std::deque<Thread *> *Thread::getThreadDependants() {
+ThreadQueue *Thread::getThreadDependants() {
   return &dependantThreads;
 }
 
@@ -162,10 +245,61 @@ std::deque<Thread *> *Thread::getThreadDependants() {
  * @param thread Thread pointer to remove from thread dependents.
  */
 void Thread::clearSyncDep(Thread *thread) {
-  for (unsigned int i = 0; i < dependantThreads.size(); ++i) {
-    if (dependantThreads[i] == thread) {
-      dependantThreads.erase(dependantThreads.begin() + i);
-      return;
-    }
-  }
-}
\ No newline at end of file
+  dependantThreads.remove(thread);
+}
+
+/**
+ * @return the length of the quanta of this thread in micro-seconds, 0 for the library's.
+ */
+int Thread::getQuantumUsecs() {
+  return quantumUsecs;
+}
+
+/**
+ * @param usecs length of the quanta of this thread in micro-seconds, 0 for the library's.
+ */
+void Thread::setQuantumUsecs(int usecs) {
+  quantumUsecs = usecs;
+}
+
+/**
+ * @return the priority of this thread, 0 being the most urgent.
+ */
+int Thread::getPriority() {
+  return priority;
+}
+
+/**
+ * @param priority - priority to set, 0 being the most urgent.
+ */
+void Thread::setPriority(int priority) {
+  this->priority = priority;
+}
+
+/**
+ * @return the weight of this thread in fair scheduling.
+ */
+int Thread::getWeight() {
+  return weight;
+}
+
+/**
+ * @param weight - weight to set.
+ */
+void Thread::setWeight(int weight) {
+  this->weight = weight;
+}
+
+/**
+ * @return the virtual runtime of this thread, in nanoseconds.
+ */
+uint64_t Thread::getVirtualRuntime() {
+  return virtualRuntime;
+}
+
+/**
+ * @param runtime - virtual runtime to set, in nanoseconds.
+ */
+void Thread::setVirtualRuntime(uint64_t runtime) {
+  virtualRuntime = runtime;
+}
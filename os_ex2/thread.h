@@ -5,46 +5,93 @@
 #include <stdio.h>
 #include <signal.h>
 #include <sys/time.h>
-#include <setjmp.h>
-#include <queue>
+#include <stddef.h>
+#include <stdint.h>
+#include "context.h"
+#include "threadQueue.h"
+#include "uthreads.h"
 
 enum ThreadStatus {
-  ready, blocked, running
+  ready, blocked, running, terminated  // terminated: by another worker, while running
 };
 
 #define STACK_SIZE 4096 /* stack size per thread (in bytes) */
-#define POST_JUMP 555 /* Signifies entry to saved point */
 #define NOT_SYNCED (-1)
 
+/* Why a thread is in the timer wheel */
+enum TimeoutKind {
+  sleeping, blockTimeout, syncTimeout
+};
+
 class Thread {
  private:
   int tid;
+  void (*tEntry)(void);
   int syncedTo;
   bool isWaitingToResume;
   int quantumRunningCounter;
   ThreadStatus tStatus;
-  char tStack[STACK_SIZE];
+  char *tStack;       // lowest usable byte of the stack
+  size_t tStackSize;  // usable bytes of the stack (0 for the main thread)
+  size_t tGuardSize;  // bytes of the PROT_NONE guard right below the stack (0 for none)
+  int priority;
+  int weight;
+  uint64_t virtualRuntime;  // nanoseconds run, scaled by UTHREAD_DEFAULT_WEIGHT / weight
+  int quantumUsecs;         // 0 for the library's quantum
 
-  std::deque<Thread *> dependantThreads;
+  ThreadQueue dependantThreads;  // threads synced to this one, linked by syncLink
 
  public:
   /**
    * Constructor of Thread object.
    * @param tid the unique id of the new thread
    * @param f pointer to function
+   * @param stackSize bytes of stack, as returned by stackSizeFor(). 0 for the main thread,
+   *        which runs on the process stack.
+   * @param guarded whether to put a guard page below the stack
+   * @throws std::bad_alloc if the stack could not be mapped
    */
-  Thread(int tid, void (*f)(void));
+  Thread(int tid, void (*f)(void), size_t stackSize, bool guarded = true);
+
+  /**
+   * Makes this object a new thread, keeping its stack - for reuse of terminated threads.
+   * @param tid the unique id of the new thread
+   * @param f pointer to function
+   */
+  void reset(int tid, void (*f)(void));
 
   /**
    * Destructor of Thread object.
    */
   ~Thread();
 
-  sigjmp_buf tEnv;
+  Context tContext;  // registers of the thread while it isn't running
+
+  /**
+   * Prepares the context of the thread to start at start, on a fresh stack.
+   * Does nothing for the main thread, whose context is saved when it first stops running.
+   * @param start the function the thread starts with - it must not return
+   */
+  void prepareContext(void (*start)(void));
+
+  ThreadLink runLink;   // links the thread in the ready queue
+  ThreadLink syncLink;  // links the thread in the dependants of the thread it is synced to
+  int readyIndex;       // position of the thread in the heap of FairScheduler, -1 if none
+  int readyWorker;      // the worker whose ready threads include this one, -1 if none
+  ThreadLink ioLink;    // links the thread in the waiters of the descriptor it waits for
+  int ioFd;             // the descriptor it waits for, -1 if none
+  ThreadLink timerLink; // links the thread in the timer wheel
+  uint64_t wakeTick;    // the tick it leaves the timer wheel at
+  TimeoutKind timeoutKind;  // why it is in the timer wheel
+  bool syncTimedOut;    // whether its last sync gave up when its time limit ran out
+  volatile sig_atomic_t inCriticalSection;  // set while it runs library code that must not
+                                            // be preempted - and while it isn't running
 
   //// tid
   int getTid();
 
+  void (*getEntry())(void);
+
   //// status
   ThreadStatus getStatus();
 
@@ -62,16 +109,40 @@ class Thread {
 
   int getSyncedTo();
 
-  void addToDependants(Thread *&ptr);
+  void addToDependants(Thread *ptr);
 
-  std::deque<Thread *> *getThreadDependants();
+  ThreadQueue *getThreadDependants();
 
   void clearSyncDep(Thread *thread);
 
+  //// stack
+  static size_t stackSizeFor(size_t stackSize);
+
+  size_t getStackSize();
+
+  bool isGuardAddress(const void *addr);
+
   //// quant
   int getQuantumRunTime();
 
   void incrementQuantumRunTime();
+
+  int getQuantumUsecs();
+
+  void setQuantumUsecs(int usecs);
+
+  //// scheduling
+  int getPriority();
+
+  void setPriority(int priority);
+
+  int getWeight();
+
+  void setWeight(int weight);
+
+  uint64_t getVirtualRuntime();
+
+  void setVirtualRuntime(uint64_t runtime);
 };
 
 #endif //OS_EX2_THREAD_H
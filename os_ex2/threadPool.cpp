@@ -0,0 +1,107 @@
+#include "threadPool.h"
+
+
+/**
+ * D-tor of ThreadPool object - frees the threads in the pool.
+ */
+ThreadPool::~ThreadPool() {
+  clear();
+}
+
+/**
+ * @param stackSize bytes of stack, as returned by Thread::stackSizeFor()
+ * @return the class of free threads with this stack size, added if there was none.
+ */
+ThreadPool::SizeClass &ThreadPool::sizeClass(size_t stackSize) {
+  for (auto &sizes : classes) {
+    if (sizes.stackSize == stackSize) {
+      return sizes;
+    }
+  }
+  classes.push_back(SizeClass{stackSize, 0, std::vector<Thread *>()});
+  return classes.back();
+}
+
+/**
+ * Adds count new threads to the free threads of a class.
+ * @param sizes the class to grow
+ * @param count number of threads to add
+ * @throws std::bad_alloc if the threads could not be allocated
+ */
+void ThreadPool::grow(SizeClass &sizes, unsigned int count) {
+  sizes.free.reserve(sizes.total + count);
+  for (unsigned int i = 0; i < count; ++i) {
+    // the threads get their tid and function when they are acquired
+    sizes.free.push_back(new Thread(-1, nullptr, sizes.stackSize, guarded));
+    sizes.total++;
+  }
+}
+
+/**
+ * @param guarded whether the stacks mapped from now on get a guard page
+ */
+void ThreadPool::setGuarded(bool guarded) {
+  this->guarded = guarded;
+}
+
+/**
+ * Makes sure count threads with the given stack size can be acquired without allocating.
+ * @param stackSize bytes of stack a thread asks for
+ * @param count number of threads
+ * @throws std::bad_alloc if the threads could not be allocated
+ */
+void ThreadPool::reserve(size_t stackSize, unsigned int count) {
+  SizeClass &sizes = sizeClass(Thread::stackSizeFor(stackSize));
+  if (sizes.free.size() < count) {
+    grow(sizes, count - (unsigned int) sizes.free.size());
+  }
+}
+
+/**
+ * Takes a free thread out of the pool, and makes it a new thread.
+ * The main thread (tid 0) runs on the process stack, so it is allocated on its own.
+ * @param tid the unique id of the new thread
+ * @param f pointer to function
+ * @param stackSize bytes of stack the thread asks for
+ * @return the new thread.
+ * @throws std::bad_alloc if the pool had to grow, and that failed
+ */
+Thread *ThreadPool::acquire(int tid, void (*f)(void), size_t stackSize) {
+  if (tid == 0) {
+    return new Thread(tid, f, 0);
+  }
+
+  SizeClass &sizes = sizeClass(Thread::stackSizeFor(stackSize));
+  if (sizes.free.empty()) {
+    grow(sizes, sizes.total == 0 ? 1 : sizes.total);
+  }
+  Thread *thread = sizes.free.back();
+  sizes.free.pop_back();
+  thread->reset(tid, f);
+  return thread;
+}
+
+/**
+ * Returns a terminated thread to the pool.
+ * @param thread the thread to release
+ */
+void ThreadPool::release(Thread *thread) {
+  if (thread->getStackSize() == 0) {
+    delete thread;
+    return;
+  }
+  sizeClass(thread->getStackSize()).free.push_back(thread);
+}
+
+/**
+ * Frees the threads in the pool. Threads which were not released are left alone.
+ */
+void ThreadPool::clear() {
+  for (auto &sizes : classes) {
+    for (auto thread : sizes.free) {
+      delete thread;
+    }
+    sizes.total -= (unsigned int) sizes.free.size();
+    sizes.free.clear();
+  }
+}
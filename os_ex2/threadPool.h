@@ -0,0 +1,48 @@
+#ifndef OS_EX2_THREAD_POOL_H
+#define OS_EX2_THREAD_POOL_H
+
+#include <stddef.h>
+#include <vector>
+#include "thread.h"
+
+/**
+ * Recycles terminated threads, along with their mapped stacks, so spawning and terminating
+ * a thread neither allocates nor maps memory once the pool holds enough of them.
+ * Free threads are kept per stack size; a size that runs out is grown by as many threads as
+ * it already has.
+ */
+class ThreadPool {
+ private:
+  struct SizeClass {
+    size_t stackSize;             // as returned by Thread::stackSizeFor()
+    unsigned int total;           // threads of this size, free or not
+    std::vector<Thread *> free;   // capacity kept at total, so release() never allocates
+  };
+
+  std::vector<SizeClass> classes;
+  bool guarded = true;  // whether new stacks get a guard page
+
+  SizeClass &sizeClass(size_t stackSize);
+
+  void grow(SizeClass &sizes, unsigned int count);
+
+ public:
+  /**
+   * Destructor of ThreadPool object - frees the threads in the pool.
+   */
+  ~ThreadPool();
+
+  //// allocation
+  void setGuarded(bool guarded);
+
+  void reserve(size_t stackSize, unsigned int count);
+
+  Thread *acquire(int tid, void (*f)(void), size_t stackSize);
+
+  void release(Thread *thread);
+
+  //// memory
+  void clear();
+};
+
+#endif //OS_EX2_THREAD_POOL_H
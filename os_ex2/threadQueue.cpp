@@ -0,0 +1,103 @@
+#include "threadQueue.h"
+#include "thread.h"
+
+
+/**
+ * Constructor of ThreadQueue object.
+ * @param link the member of Thread which links the threads of this queue
+ */
+ThreadQueue::ThreadQueue(ThreadLink Thread::*link) : link(link), head(nullptr), tail(nullptr),
+                                                    count(0) {
+}
+
+/**
+ * @return the first thread in the queue, nullptr if it is empty.
+ */
+Thread *ThreadQueue::front() {
+  return head;
+}
+
+/**
+ * @return true iff there are no threads in the queue.
+ */
+bool ThreadQueue::empty() {
+  return head == nullptr;
+}
+
+/**
+ * @return the number of threads in the queue.
+ */
+size_t ThreadQueue::size() {
+  return count;
+}
+
+/**
+ * @param thread a thread
+ * @return true iff thread is in this queue.
+ */
+bool ThreadQueue::contains(Thread *thread) {
+  return (thread->*link).queue == this;
+}
+
+/**
+ * Appends a thread to the end of the queue.
+ * The thread must not be in any queue of the same link.
+ * @param thread the thread to append
+ */
+void ThreadQueue::pushBack(Thread *thread) {
+  ThreadLink &threadLink = thread->*link;
+  threadLink.prev = tail;
+  threadLink.next = nullptr;
+  threadLink.queue = this;
+  if (tail != nullptr) {
+    (tail->*link).next = thread;
+  } else {
+    head = thread;
+  }
+  tail = thread;
+  count++;
+}
+
+/**
+ * Removes the first thread of the queue.
+ * @return the removed thread, nullptr if the queue was empty.
+ */
+Thread *ThreadQueue::popFront() {
+  Thread *thread = head;
+  if (thread != nullptr) {
+    remove(thread);
+  }
+  return thread;
+}
+
+/**
+ * Removes a thread from the queue, wherever it is. Does nothing if it is not in this queue.
+ * @param thread the thread to remove
+ */
+void ThreadQueue::remove(Thread *thread) {
+  ThreadLink &threadLink = thread->*link;
+  if (threadLink.queue != this) {
+    return;
+  }
+  if (threadLink.prev != nullptr) {
+    (threadLink.prev->*link).next = threadLink.next;
+  } else {
+    head = threadLink.next;
+  }
+  if (threadLink.next != nullptr) {
+    (threadLink.next->*link).prev = threadLink.prev;
+  } else {
+    tail = threadLink.prev;
+  }
+  threadLink.prev = threadLink.next = nullptr;
+  threadLink.queue = nullptr;
+  count--;
+}
+
+/**
+ * Removes all the threads from the queue.
+ */
+void ThreadQueue::clear() {
+  while (popFront() != nullptr) {
+  }
+}
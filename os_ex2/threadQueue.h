@@ -0,0 +1,61 @@
+#ifndef OS_EX2_THREAD_QUEUE_H
+#define OS_EX2_THREAD_QUEUE_H
+
+#include <stddef.h>
+
+class Thread;
+
+class ThreadQueue;
+
+/**
+ * The links of a thread in one kind of ThreadQueue, kept inside the Thread itself.
+ */
+struct ThreadLink {
+  Thread *prev = nullptr;
+  Thread *next = nullptr;
+  ThreadQueue *queue = nullptr;  // the queue the thread is in, nullptr if none
+};
+
+/**
+ * A FIFO queue of threads, linked through a ThreadLink member of Thread, so a thread is
+ * added, removed from anywhere in the queue, and looked up without allocating or scanning.
+ * A thread can be in one queue of each of its links at a time.
+ */
+class ThreadQueue {
+ private:
+  ThreadLink Thread::*link;
+  Thread *head;
+  Thread *tail;
+  size_t count;
+
+ public:
+  /**
+   * Constructor of ThreadQueue object.
+   * @param link the member of Thread which links the threads of this queue
+   */
+  explicit ThreadQueue(ThreadLink Thread::*link);
+
+  ThreadQueue(const ThreadQueue &) = delete;
+
+  ThreadQueue &operator=(const ThreadQueue &) = delete;
+
+  //// access
+  Thread *front();
+
+  bool empty();
+
+  size_t size();
+
+  bool contains(Thread *thread);
+
+  //// modification
+  void pushBack(Thread *thread);
+
+  Thread *popFront();
+
+  void remove(Thread *thread);
+
+  void clear();
+};
+
+#endif //OS_EX2_THREAD_QUEUE_H
@@ -0,0 +1,172 @@
+#include "timerWheel.h"
+
+#define WHEEL_MASK ((uint64_t) WHEEL_SLOTS - 1)
+#define WHEEL_SPAN ((uint64_t) 1 << (WHEEL_BITS * WHEEL_LEVELS))
+
+TimerWheel::Slot::Slot() : ThreadQueue(&Thread::timerLink) {
+}
+
+/**
+ * Constructor of TimerWheel object - an empty wheel at tick 0.
+ */
+TimerWheel::TimerWheel() : nonEmpty(), now(0), count(0) {
+}
+
+/**
+ * Puts a thread in the slot of its tick, or of earliest if that is later - or of the last tick
+ * the wheel spans, if its tick is beyond that.
+ */
+void TimerWheel::place(Thread *thread, uint64_t earliest) {
+  uint64_t tick = (thread->wakeTick < earliest) ? earliest : thread->wakeTick;
+  if (tick - now >= WHEEL_SPAN) {
+    tick = now + WHEEL_SPAN - 1;
+  }
+
+  // the lowest level whose slots reach that far
+  uint64_t distance = tick - now;
+  int level = 0;
+  while (distance >= WHEEL_SLOTS) {
+    distance >>= WHEEL_BITS;
+    level++;
+  }
+  int index = (int) ((tick >> (level * WHEEL_BITS)) & WHEEL_MASK);
+  slots[level][index].pushBack(thread);
+  nonEmpty[level] |= (uint64_t) 1 << index;
+  count++;
+}
+
+/**
+ * Takes a thread out of its slot.
+ */
+void TimerWheel::take(Thread *thread) {
+  auto slot = static_cast<Slot *>(thread->timerLink.queue);
+  slot->remove(thread);
+  if (slot->empty()) {
+    int position = (int) (slot - &slots[0][0]);
+    nonEmpty[position / WHEEL_SLOTS] &= ~((uint64_t) 1 << (position % WHEEL_SLOTS));
+  }
+  count--;
+}
+
+/**
+ * Adds a thread, to expire at tick (set as its wakeTick) - or at the next tick, if that one
+ * has passed.
+ * @param thread a thread not in the wheel
+ * @param tick the tick it expires at
+ */
+void TimerWheel::add(Thread *thread, uint64_t tick) {
+  thread->wakeTick = tick;
+  place(thread, now + 1);
+}
+
+/**
+ * Removes a thread before it expires. Does nothing if it is not in the wheel.
+ * @param thread the thread to remove
+ */
+void TimerWheel::remove(Thread *thread) {
+  if (contains(thread)) {
+    take(thread);
+  }
+}
+
+/**
+ * @param thread a thread
+ * @return true iff thread is in the wheel.
+ */
+bool TimerWheel::contains(Thread *thread) {
+  return thread->timerLink.queue != nullptr;
+}
+
+/**
+ * @return true iff there are no threads in the wheel.
+ */
+bool TimerWheel::empty() {
+  return count == 0;
+}
+
+/**
+ * @return the next tick with something to do - a thread to expire, or to move down a level -
+ * UINT64_MAX if the wheel is empty. O(WHEEL_LEVELS).
+ */
+uint64_t TimerWheel::nextTick() {
+  uint64_t next = UINT64_MAX;
+  for (int level = 0; level < WHEEL_LEVELS; level++) {
+    uint64_t slotMask = nonEmpty[level];
+    if (slotMask == 0) {
+      continue;
+    }
+
+    // the first non-empty slot after the current one, around the level
+    int shift = level * WHEEL_BITS;
+    uint64_t current = now >> shift;
+    int start = (int) ((current + 1) & WHEEL_MASK);
+    uint64_t rotated = (start == 0) ? slotMask : (slotMask >> start) | (slotMask << (WHEEL_SLOTS - start));
+    uint64_t tick = (current + 1 + __builtin_ctzll(rotated)) << shift;
+    if (tick < next) {
+      next = tick;
+    }
+  }
+  return next;
+}
+
+/**
+ * Advances the wheel to tick, and passes each thread that expires by then to expired.
+ * Ticks with nothing to do are skipped, so advancing is as cheap over an hour as over a tick.
+ * @param tick the current tick
+ * @param expired called with each expired thread, which is already out of the wheel
+ * @return the number of threads that expired.
+ */
+int TimerWheel::advance(uint64_t tick, void (*expired)(Thread *)) {
+  int woken = 0;
+  while (now < tick) {
+    uint64_t next = (count == 0) ? UINT64_MAX : nextTick();
+    if (next > tick) {
+      now = tick;
+      break;
+    }
+    now = next;
+
+    // the current tick enters a slot of each level it is a multiple of: its threads move down
+    for (int level = WHEEL_LEVELS - 1; level > 0; level--) {
+      int shift = level * WHEEL_BITS;
+      if ((now & (((uint64_t) 1 << shift) - 1)) != 0) {
+        continue;
+      }
+      Slot &slot = slots[level][(now >> shift) & WHEEL_MASK];
+      while (!slot.empty()) {
+        Thread *thread = slot.front();
+        take(thread);
+        place(thread, now);
+      }
+    }
+
+    Slot &slot = slots[0][now & WHEEL_MASK];
+    while (!slot.empty()) {
+      Thread *thread = slot.front();
+      take(thread);
+      if (thread->wakeTick > now) {
+        // it was beyond the span - on to the end of it again
+        place(thread, now + 1);
+      } else {
+        expired(thread);
+        woken++;
+      }
+    }
+  }
+  return woken;
+}
+
+/**
+ * Removes all the threads.
+ */
+void TimerWheel::clear() {
+  for (auto &level : slots) {
+    for (Slot &slot : level) {
+      slot.clear();
+    }
+  }
+  for (uint64_t &slotMask : nonEmpty) {
+    slotMask = 0;
+  }
+  count = 0;
+}
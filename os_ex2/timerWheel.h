@@ -0,0 +1,57 @@
+#ifndef OS_EX2_TIMER_WHEEL_H
+#define OS_EX2_TIMER_WHEEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "thread.h"
+
+#define WHEEL_BITS 6                         /* log2 of the slots of a level */
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 5                       /* the wheel spans WHEEL_SLOTS ^ WHEEL_LEVELS ticks */
+
+/**
+ * The threads waiting for a tick - sleeping, or waiting with a time limit - on a hierarchical
+ * timing wheel. Level l has a slot per WHEEL_SLOTS ^ l ticks; a thread goes to the lowest level
+ * that reaches its tick from the current one, and moves down a level whenever the current tick
+ * enters its slot, until its slot of the lowest level expires. Adding and removing a thread is
+ * O(1), and so is expiring it, but for moving down at most WHEEL_LEVELS - 1 times. Ticks with
+ * nothing to do are skipped, by a bit mask of the non-empty slots of each level.
+ * Threads are linked in the slots through timerLink.
+ */
+class TimerWheel {
+ private:
+  struct Slot : ThreadQueue {
+    Slot();
+  };
+
+  Slot slots[WHEEL_LEVELS][WHEEL_SLOTS];
+  uint64_t nonEmpty[WHEEL_LEVELS];  // bit i of level l is set iff slots[l][i] has threads
+  uint64_t now;                     // the last tick advanced to
+  size_t count;
+
+  void place(Thread *thread, uint64_t earliest);
+
+  void take(Thread *thread);
+
+ public:
+  TimerWheel();
+
+  //// waiting
+  void add(Thread *thread, uint64_t tick);
+
+  void remove(Thread *thread);
+
+  bool contains(Thread *thread);
+
+  bool empty();
+
+  //// time
+  uint64_t nextTick();
+
+  int advance(uint64_t tick, void (*expired)(Thread *));
+
+  //// memory
+  void clear();
+};
+
+#endif //OS_EX2_TIMER_WHEEL_H
@@ -1,12 +1,30 @@
 
 #include "uthreads.h"
 
+#include <atomic>
+#include <cstdio>
+#include <cstring>
 #include <iostream>
-#include <deque>
 #include <functional>
 #include <vector>
 #include <queue>
+#include <string>
+#include <utility>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "context.h"
+#include "ioPoller.h"
+#include "timerWheel.h"
 #include "thread.h"
+#include "threadPool.h"
+#include "scheduler.h"
 
 
 //// ============================   defines and const ==============================================
@@ -14,38 +32,147 @@
 #define SYS_ERR 406 // Not acceptable
 #define THRD_ERR 418    // I'm a teapot
 #define SEC_IN_MICROSEC 1000000
+#define INITIAL_POOL_SIZE 16 // threads with a STACK_SIZE stack, mapped by uthread_init
+#define ALT_STACK_SIZE 65536 // stack for the overflow handler, which can't run on the overflowed one
+#define IDLE_STACK_SIZE 65536 // stack for the idle loop of the first worker
+#define IDLE_PAUSE_NSEC 50000 // how long an idle worker sleeps between looking for ready threads
+#define TIMER_TICK_NSEC 1000000 // resolution of sleeps and time limits
+#define LOCK_SPINS 64 // spins on the library lock before giving the CPU to its holder
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
 
 //// ============================   fields =========================================================
 
-Thread *threadList[MAX_THREAD_NUM]{nullptr};
-std::deque<Thread *> readyThreads;
-Thread *running_thread = nullptr;
-std::priority_queue<int, std::vector<int>, std::greater<int> > tidMinHeap;
+/**
+ * A kernel thread running uthreads: the one that called uthread_init, and in M:N mode the ones
+ * the library started. Each has its own ready threads and quantum timer, and an idle loop that
+ * runs while it has no uthread to run. Only the worker itself touches running, zombie, switches,
+ * preemptionPending and the timer; the rest is guarded by the library lock.
+ */
+struct Worker {
+  int index;
+  pthread_t thread;
+  Thread *running = nullptr;  // nullptr while idle
+  Thread *zombie = nullptr;   // a thread that terminated, freed once we're off its stack
+  volatile unsigned long switches = 0;  // times running changed, see currentThread()
+  Scheduler *scheduler = nullptr;       // the ready threads, in the order of the policy
+  volatile sig_atomic_t preemptionPending = 0;  // a quantum ended inside a critical section
+  bool timerArmed = false;    // false while idle, or tickless and alone
+  timer_t timer;              // its own CPU time timer, in M:N mode
+  Context idleContext = nullptr;  // where the idle loop stopped to run a uthread
+  std::vector<char> idleStack;    // of the first worker - the others have their own
+  std::vector<char> altStack;     // for the overflow handler
+};
+
+std::vector<Thread *> threadList;  // slot table, indexed by tid - grows as needed
+std::vector<Worker *> workers;
+thread_local Worker *thisWorker = nullptr;  // read through currentWorker()
+bool multiWorker = false;  // M:N mode: the workers share the structures below the library lock
+std::atomic_flag libraryLock = ATOMIC_FLAG_INIT;
+std::priority_queue<int, std::vector<int>, std::greater<int> > tidMinHeap; // free tids (LOWEST)
+std::vector<int> freeTids;  // free tids, most recently freed last (RECENT)
+uthread_tid_order tidOrder = UTHREAD_TID_LOWEST;
+int maxThreads = MAX_THREAD_NUM;  // negative for no limit
+int liveThreads = 0;
+ThreadPool threadPool; // terminated threads and their stacks, for reuse by uthread_spawn
+IoPoller ioPoller;     // threads waiting for descriptors, in uthread_read and the like
+TimerWheel timerWheel; // sleeping threads, and threads waiting with a time limit
 
 struct itimerval timer; // the interval timer
 struct sigaction sa;    // the sigaction defined for SIGVTALRM.
-sigset_t blockedSignalSet;  // set of signals to block on critical code-blocks.
 int totalQuantumsRunning;
+bool tickless = false;   // stop the timer while only one thread is runnable
 
 
 //// ============================   forward declarations for helper funcs ==========================
 
 //// scheduling
-void timesUp(int sig);
+void timesUp(int sig, siginfo_t *info, void *context);
+
+void preempt();
+
+void startThread();
 
 void goToNextThread();
 
 void selfBlockAdjustment();
 
-void removeFromReady(const Thread *toRemove);
+void stackOverflow(int sig, siginfo_t *info, void *context);
+
+void removeFromReady(Thread *toRemove);
+
+void makeReady(Thread *thread);
+
+void enqueue(Worker *worker, Thread *thread);
+
+Thread *takeReady(Worker *worker);
+
+bool steal(Worker *thief);
+
+void startQuantum(Worker *worker, Thread *thread);
+
+void armTimer(Worker *worker);
+
+void setTimer(Worker *worker, const struct itimerval &value);
+
+//// workers
+Worker *currentWorker();
+
+Thread *currentThread();
+
+Worker *workerRunning(Thread *thread);
+
+void stopRunning(Thread *thread);
+
+void idleLoop(Worker *worker);
+
+void startIdle();
+
+void *startWorker(void *arg);
+
+void lockLibrary();
+
+void unlockLibrary();
 
 //// dependencies
 void reviveDependants(int tid);
 
 void clearSyncTo(int tid);
 
+//// I/O
+int setNonBlocking(int fd);
+
+bool retryIo(int fd, uint32_t events);
+
+int awaitIo(int fd, uint32_t events);
+
+void wakeIo(Thread *thread);
+
+bool pollIo(int timeoutMillis);
+
+//// timers
+uint64_t currentTick();
+
+int64_t nanosUntilNextTimer();
+
+void addTimer(Thread *thread, int usecs, TimeoutKind kind);
+
+bool expireTimers();
+
+void wakeTimer(Thread *thread);
+
+void resumeThread(Thread *thread);
+
+void idleWait();
+
 //// naming
-void initialiseMinHeap();
+void initialiseTids(const uthread_config *config);
+
+int allocateTid();
+
+void releaseTid(int tid);
 
 int isLegalTid(int tid);
 
@@ -54,23 +181,35 @@ void freeAllMemory();
 
 void terminateThread(Thread *thread);
 
+void reapZombie(Worker *worker);
+
+void exitProcess(int status);
+
 //// errors
 void print_error(int type, const std::string &message = "unknown error");
 
-//// signal blocking
-void blockSignals();
+//// critical sections
+void enterCriticalSection();
 
-void unblockSignals();
-
-void unblockSignalsAndIgnorePending();
+void leaveCriticalSection();
 
 //// initialisation
 void initTimerHandler();
 
+void initOverflowHandler();
+
 void initQuant(int quantum_usecs);
 
 int spawnMainThread();
 
+Worker *initWorker(int index);
+
+void initWorkerSignals(Worker *worker);
+
+void startWorkers(int count);
+
+struct itimerval quantumOf(Thread *thread);
+
 //// ============================   library functions ==============================================
 
 /*
@@ -82,9 +221,30 @@ int spawnMainThread();
  * Return value: On success, return 0. On failure, return -1.
 */
 int uthread_init(int quantum_usecs) {
+  uthread_config config{};
+  return uthread_init_config(quantum_usecs, &config);
+}
+
+/*
+ * Description: This function initializes the thread library like
+ * uthread_init, with the options in config (see uthread_config). It is
+ * called instead of uthread_init, not in addition to it.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_config(int quantum_usecs, const uthread_config *config) {
+
+  if (config == nullptr) {
+    print_error(THRD_ERR, "Init called without a config.");
+    return -1;
+  }
 
-  // initialise a min heap for all legal tid's (including 0 )
-  initialiseMinHeap();
+  if (config->workers < 0) {
+    print_error(THRD_ERR, "Number of workers must not be negative.");
+    return -1;
+  }
+
+  // set up the slot table and the free tids (tid 0 included)
+  initialiseTids(config);
 
   // set constants ( quantum, etc) (error handling)
   if (quantum_usecs <= 0) {
@@ -94,6 +254,29 @@ int uthread_init(int quantum_usecs) {
 
   // configure quantum and timer.
   initQuant(quantum_usecs);
+  tickless = (config->tickless != 0);
+
+  // the workers, each with its ready threads ordered by the policy - this thread is the first
+  int workerCount = (config->workers > 1) ? config->workers : 1;
+  multiWorker = (workerCount > 1);
+  for (int i = 0; i < workerCount; i++) {
+    Worker *worker = initWorker(i);
+    worker->scheduler = Scheduler::create(config);
+    if (worker->scheduler == nullptr) {
+      print_error(THRD_ERR, "Init called with an unknown scheduling policy.");
+      return -1;
+    }
+  }
+  thisWorker = workers[0];
+  workers[0]->thread = pthread_self();
+
+  // map the stacks of the first threads up front, so spawning them doesn't have to
+  threadPool.setGuarded(config->unguarded_stacks == 0);
+  try {
+    threadPool.reserve(STACK_SIZE, INITIAL_POOL_SIZE);
+  } catch (std::exception &e) {
+    print_error(SYS_ERR, "Failed to map the stacks of the thread pool.");
+  }
 
   // spawn main thread
   int status = spawnMainThread();
@@ -102,14 +285,20 @@ int uthread_init(int quantum_usecs) {
   // install timesUp() as handler for timer signals
   initTimerHandler();
 
+  // report faults on the stack guard pages
+  initOverflowHandler();
+  initWorkerSignals(workers[0]);
+
   // set first running thread
-  running_thread = readyThreads.front();
-  readyThreads.pop_front();
+  Worker *first = workers[0];
+  first->running = takeReady(first);
+  first->scheduler->started(first->running);
 
   // set the timer.
-  if (setitimer(ITIMER_VIRTUAL, &timer, nullptr) < 0) {
-    print_error(SYS_ERR, "Call to setitimer failed.");
-  }
+  armTimer(first);
+
+  // the other workers take ready threads from the first one as soon as there are
+  startWorkers(workerCount);
 
   // all done!
   return 0;
@@ -120,33 +309,57 @@ int uthread_init(int quantum_usecs) {
  * function f with the signature void f(void). The thread is added to the end
  * of the READY threads list. The uthread_spawn function should fail if it
  * would cause the number of concurrent threads to exceed the limit
- * (MAX_THREAD_NUM). Each thread should be allocated with a stack of size
- * STACK_SIZE bytes.
+ * (MAX_THREAD_NUM, unless set by uthread_init_config). Each thread should
+ * be allocated with a stack of size STACK_SIZE bytes.
  * Return value: On success, return the ID of the created thread.
  * On failure, return -1.
 */
 int uthread_spawn(void (*f)(void)) {
+  return uthread_spawn_stack(f, STACK_SIZE);
+}
+
+/*
+ * Description: This function creates a new thread like uthread_spawn, but
+ * with a stack of stack_size bytes (rounded up to whole pages) instead of
+ * STACK_SIZE. Every stack sits above an inaccessible guard page, so a thread
+ * overflowing its stack is reported as a thread library error, and the
+ * process exits, instead of corrupting memory. It is an error to call this
+ * function with non-positive stack_size.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_stack(void (*f)(void), int stack_size) {
+
+  if (stack_size <= 0) {
+    print_error(THRD_ERR, "Stack size must be strictly positive.");
+    return -1;
+  }
 
-  blockSignals();
-  // get new tid from min heap - if none - we are at limit.
-  int newId = tidMinHeap.top();
-  if (newId == MAX_THREAD_NUM) {
+  enterCriticalSection();
+  // get a free tid - if none - we are at limit.
+  int newId;
+  try {
+    newId = allocateTid();
+  } catch (std::exception &e) {
+    print_error(SYS_ERR, "Failed to grow the thread table.");
+  }
+  if (newId < 0) {
     print_error(THRD_ERR, "Attempted to spawn thread beyond max thread limit.");
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
-  // create thread (and allocate stack (in thread or here? )) (check success)
+  // take a thread and its stack from the pool, which grows if it ran out (check success)
   Thread *threadToSpawn;
   try {
-    threadToSpawn = new Thread(newId, f);
+    threadToSpawn = threadPool.acquire(newId, f, (size_t) stack_size);
   } catch (std::exception &e) {
     print_error(SYS_ERR, "Call to new failed for Thread.");
   }
+  threadToSpawn->prepareContext(&startThread);
   threadList[newId] = threadToSpawn;
-  tidMinHeap.pop();
-  readyThreads.push_back(threadToSpawn);
-  unblockSignals();
+  makeReady(threadToSpawn);
+  leaveCriticalSection();
   return newId;
 }
 
@@ -163,23 +376,22 @@ int uthread_spawn(void (*f)(void)) {
 */
 int uthread_terminate(int tid) {
 
-  // block thread's signals for duration of this function.
-  blockSignals();
+  // no preemption for duration of this function.
+  enterCriticalSection();
 
   // error handling
   if (!isLegalTid(tid)) {
     print_error(THRD_ERR, "Terminate called with illegal thread id.");
 
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
   // if terminating thread is the main thread (tid = 0)
   // call d-tor for all threads + exit(0)
   if (tid == 0) {
-    freeAllMemory();
-    exit(0);
+    exitProcess(0);
   }
 
   // move waiting threads to ready if possible.
@@ -188,14 +400,15 @@ int uthread_terminate(int tid) {
   // remove terminating thread from mater's waitlist, if it is on one.
   clearSyncTo(tid);
 
+  // and from the waiters of a descriptor, and the timer wheel
+  ioPoller.cancel(threadList[tid]);
+  timerWheel.remove(threadList[tid]);
+
   // if terminated thread is running thread - scheduling decision (jump)
-  if (tid == uthread_get_tid()) {
+  if (threadList[tid] == currentWorker()->running) {
 
     // delete running thread
-    terminateThread(running_thread);
-
-    // unblock signals and ignored pending because we are making scheduling decision anyway.
-    unblockSignalsAndIgnorePending();
+    terminateThread(threadList[tid]);
 
     // go to next ready thread
     // (there must be one, because the running thread at this point cannot be main)
@@ -203,7 +416,8 @@ int uthread_terminate(int tid) {
 
   } else {
 
-    // case: other (non running) thread is terminated  - data change only, and return
+    // case: other thread is terminated  - data change only, and return
+    // (if it runs on another worker, that worker stops running it)
     // get rid of terminated thread:
     Thread *terminate = threadList[tid];
 
@@ -214,7 +428,7 @@ int uthread_terminate(int tid) {
     terminateThread(terminate);
 
     // unblock and finish
-    unblockSignalsAndIgnorePending();
+    leaveCriticalSection();
   }
   return 0;
 }
@@ -229,9 +443,21 @@ int uthread_terminate(int tid) {
  * Return value: On success, return 0. On failure, return -1.
 */
 int uthread_block(int tid) {
+  return uthread_block_timeout(tid, -1);
+}
 
-  // block thread's signals for duration of this function.
-  blockSignals();
+/*
+ * Description: This function blocks the thread with ID tid like
+ * uthread_block, for at most timeout_usecs micro-seconds: then it is resumed
+ * as if by uthread_resume, unless it was resumed before. A negative
+ * timeout_usecs means no time limit. A thread already waiting with a time
+ * limit (sleeping, or in uthread_sync_timeout) is blocked without one.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_block_timeout(int tid, int timeout_usecs) {
+
+  // no preemption for duration of this function.
+  enterCriticalSection();
 
 
   // error handling
@@ -240,7 +466,7 @@ int uthread_block(int tid) {
     print_error(THRD_ERR, "Block called with illegal thread id.");
 
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
@@ -249,38 +475,41 @@ int uthread_block(int tid) {
     print_error(THRD_ERR, "Attempted to block main thread.");
 
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
   if (threadList[tid]->getIsWaitingToResume()) {
 
     // unblock and finish
-    unblockSignals();
+    leaveCriticalSection();
     return 0;
   }
 
+  // the time limit, unless the thread is already waiting for one
+  if (timeout_usecs >= 0 && !timerWheel.contains(threadList[tid])) {
+    addTimer(threadList[tid], timeout_usecs, blockTimeout);
+  }
+
   // if the running thread is blocking itself, call the selfBlock function
   // this will also take care of jumping to the next thread
-  if (tid == uthread_get_tid()) {
+  if (threadList[tid] == currentWorker()->running) {
 
     //change thread status to blocked
-    running_thread->blockThread();
+    threadList[tid]->blockThread();
     selfBlockAdjustment();
     // else if ready:   just move to blocked
   } else {
 
     Thread *threadToBlock = threadList[tid];
     threadToBlock->blockThread();
-    for (unsigned int i = 0; i < readyThreads.size(); ++i) {
-      if (readyThreads[i] == threadToBlock) {
+    removeFromReady(threadToBlock);
 
-        readyThreads.erase(readyThreads.begin() + i);
-      }
-    }
+    // if running on another worker - that one stops running it
+    stopRunning(threadToBlock);
 
     // unblock and finish
-    unblockSignals();
+    leaveCriticalSection();
 
   }
   return 0;
@@ -295,8 +524,8 @@ int uthread_block(int tid) {
 */
 int uthread_resume(int tid) {
 
-  // block thread's signals for duration of this function.
-  blockSignals();
+  // no preemption for duration of this function.
+  enterCriticalSection();
 
 
   // error handling
@@ -305,25 +534,17 @@ int uthread_resume(int tid) {
     print_error(THRD_ERR, "Resume called with illegal thread id.");
 
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
   Thread *threadToResume = threadList[tid];
 
   if (threadToResume->getIsWaitingToResume()) {
-
-    threadToResume->unblockThread();
-
-    if (threadToResume->getSyncedTo() == NOT_SYNCED) {
-
-      threadToResume->setStatus(ready);
-
-      readyThreads.push_back(threadToResume);
-    }
+    resumeThread(threadToResume);
   }
 
   // unblock and finish
-  unblockSignals();
+  leaveCriticalSection();
   return 0;
 }
 
@@ -335,16 +556,27 @@ int uthread_resume(int tid) {
  * Return value: On success, return 0. On failure, return -1.
 */
 int uthread_sync(int tid) {
+  return uthread_sync_timeout(tid, -1);
+}
 
-  // block thread's signals for duration of this function.
-  blockSignals();
+/*
+ * Description: This function blocks the RUNNING thread like uthread_sync,
+ * until thread with ID tid will terminate, or timeout_usecs micro-seconds
+ * pass - whichever comes first. A negative timeout_usecs means no time limit.
+ * Return value: 0 if thread tid terminated, 1 if the time ran out first.
+ * On failure, return -1.
+*/
+int uthread_sync_timeout(int tid, int timeout_usecs) {
+
+  // no preemption for duration of this function.
+  enterCriticalSection();
 
   // error handling
   if (!isLegalTid(tid)) {
 
     print_error(THRD_ERR, "Sync called with illegal thread id.");
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
@@ -352,7 +584,7 @@ int uthread_sync(int tid) {
 
     print_error(THRD_ERR, "Thread attempted Sync to itself.");
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
@@ -360,21 +592,83 @@ int uthread_sync(int tid) {
 
     print_error(THRD_ERR, "Main thread attempted to call Sync.");
     // unblock and error
-    unblockSignals();
+    leaveCriticalSection();
     return -1;
   }
 
+  Thread *thread = currentWorker()->running;
+
   // change RUNNING's sycedTo field to match the given tid
-  running_thread->setSyncedTo(tid);
+  thread->setSyncedTo(tid);
   // change RUNNING's status to blocked
-  running_thread->setStatus(blocked);
+  thread->setStatus(blocked);
 
   // append &(RUNNING) to (tid)'s  dependents queue(which is a field of *(tid))
-  threadList[tid]->addToDependants(running_thread);
+  threadList[tid]->addToDependants(thread);
+
+  // the time limit
+  thread->syncTimedOut = false;
+  if (timeout_usecs >= 0) {
+    addTimer(thread, timeout_usecs, syncTimeout);
+  }
 
   // make the self-block scheduling adjustment
   selfBlockAdjustment();
 
+  return thread->syncTimedOut ? 1 : 0;
+}
+
+/*
+ * Description: This function moves the RUNNING thread to the end of the
+ * READY threads list, and makes a scheduling decision, like the end of its
+ * quantum does. If no other thread is READY, the RUNNING thread continues
+ * in the same quantum.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_yield() {
+
+  // no preemption for duration of this function.
+  enterCriticalSection();
+
+  Worker *worker = currentWorker();
+  if (worker->scheduler->empty() && !steal(worker)) {
+    leaveCriticalSection();
+    return 0;
+  }
+
+  Thread *thread = worker->running;
+  thread->setStatus(ready);
+  worker->scheduler->stopped(thread);
+  enqueue(worker, thread);
+  goToNextThread();
+
+  // running again
+  leaveCriticalSection();
+  return 0;
+}
+
+/*
+ * Description: This function blocks the RUNNING thread for usecs
+ * micro-seconds (at least, and to the resolution of a millisecond), and
+ * makes a scheduling decision. If it is blocked by uthread_block meanwhile,
+ * it runs again only once resumed as well. It is an error to call this
+ * function with negative usecs.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_usecs(int usecs) {
+
+  if (usecs < 0) {
+    print_error(THRD_ERR, "Sleep time must not be negative.");
+    return -1;
+  }
+
+  // no preemption for duration of this function.
+  enterCriticalSection();
+
+  Thread *thread = currentWorker()->running;
+  addTimer(thread, usecs, sleeping);
+  thread->setStatus(blocked);
+  selfBlockAdjustment();
   return 0;
 }
 
@@ -383,7 +677,7 @@ int uthread_sync(int tid) {
  * Return value: The ID of the calling thread.
 */
 int uthread_get_tid() {
-  return running_thread->getTid();
+  return currentThread()->getTid();
 }
 
 /*
@@ -412,17 +706,188 @@ int uthread_get_total_quantums() {
 */
 int uthread_get_quantums(int tid) {
 
+  // other workers may spawn or terminate meanwhile
+  enterCriticalSection();
+
   //error checking
   if (!isLegalTid(tid)) {
     print_error(THRD_ERR, "Get quantums called with illegal thread id.");
+    leaveCriticalSection();
     return -1;
   }
 
   // return value from *(tid)'s quantum counter  (which is a field of *(tid))
-  return threadList[tid]->getQuantumRunTime();
+  int quantums = threadList[tid]->getQuantumRunTime();
+  leaveCriticalSection();
+  return quantums;
 
 }
 
+/*
+ * Description: This function sets the priority of the thread with ID tid,
+ * from 0 (most urgent) to UTHREAD_PRIORITY_LEVELS - 1. Under
+ * UTHREAD_POLICY_PRIORITY, a READY thread moves to the end of the threads
+ * of its new priority; the new priority takes effect in the next scheduling
+ * decision. Under other policies the priority is only kept. It is an error
+ * if no thread with ID tid exists, or if priority is out of range.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority) {
+
+  enterCriticalSection();
+
+  if (!isLegalTid(tid)) {
+    print_error(THRD_ERR, "Set priority called with illegal thread id.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  if (priority < 0 || priority >= UTHREAD_PRIORITY_LEVELS) {
+    print_error(THRD_ERR, "Priority out of range.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  Thread *thread = threadList[tid];
+  thread->setPriority(priority);
+  if (thread->readyWorker >= 0) {
+    workers[thread->readyWorker]->scheduler->updated(thread);
+  }
+
+  leaveCriticalSection();
+  return 0;
+}
+
+/*
+ * Description: This function sets the weight of the thread with ID tid.
+ * Under UTHREAD_POLICY_FAIR, threads get CPU time in proportion to their
+ * weights; UTHREAD_DEFAULT_WEIGHT is the weight of a new thread. Under other
+ * policies the weight is only kept. It is an error if no thread with ID tid
+ * exists, or if weight is non-positive.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_weight(int tid, int weight) {
+
+  enterCriticalSection();
+
+  if (!isLegalTid(tid)) {
+    print_error(THRD_ERR, "Set weight called with illegal thread id.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  if (weight <= 0) {
+    print_error(THRD_ERR, "Weight must be strictly positive.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  // charge the running thread at its old weight, up to now
+  Worker *worker = currentWorker();
+  Thread *thread = threadList[tid];
+  if (thread == worker->running) {
+    worker->scheduler->stopped(thread);
+    worker->scheduler->started(thread);
+  }
+  thread->setWeight(weight);
+  if (thread->readyWorker >= 0) {
+    workers[thread->readyWorker]->scheduler->updated(thread);
+  }
+
+  leaveCriticalSection();
+  return 0;
+}
+
+/*
+ * Description: This function sets the length of the quanta of the thread
+ * with ID tid in micro-seconds, from its next quantum on. 0 sets it back to
+ * the quantum given to uthread_init. It is an error if no thread with ID tid
+ * exists, or if quantum_usecs is negative.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_quantum(int tid, int quantum_usecs) {
+
+  enterCriticalSection();
+
+  if (!isLegalTid(tid)) {
+    print_error(THRD_ERR, "Set quantum called with illegal thread id.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  if (quantum_usecs < 0) {
+    print_error(THRD_ERR, "Quantum must not be negative.");
+    leaveCriticalSection();
+    return -1;
+  }
+
+  threadList[tid]->setQuantumUsecs(quantum_usecs);
+
+  leaveCriticalSection();
+  return 0;
+}
+
+/*
+ * Description: This function reads up to count bytes from the descriptor fd
+ * into buf, like read(2), but blocks only the RUNNING thread: while fd has
+ * nothing to read, the thread is BLOCKED, and the other threads run. fd is
+ * put in non-blocking mode. If the thread is blocked by uthread_block
+ * meanwhile, it runs again only once resumed as well. Called before
+ * uthread_init, it doesn't block: it fails with EAGAIN, like read(2) on a
+ * non-blocking descriptor.
+ * Return value: Like read(2): the number of bytes read, 0 at end of file,
+ * or -1 with errno set.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count) {
+
+  if (setNonBlocking(fd) < 0) {
+    return -1;
+  }
+  ssize_t result;
+  do {
+    result = read(fd, buf, count);
+  } while (result < 0 && retryIo(fd, EPOLLIN));
+  return result;
+}
+
+/*
+ * Description: This function writes up to count bytes from buf to the
+ * descriptor fd, like write(2), but blocks only the RUNNING thread, like
+ * uthread_read, while fd has no room for any of them.
+ * Return value: Like write(2): the number of bytes written, or -1 with
+ * errno set.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count) {
+
+  if (setNonBlocking(fd) < 0) {
+    return -1;
+  }
+  ssize_t result;
+  do {
+    result = write(fd, buf, count);
+  } while (result < 0 && retryIo(fd, EPOLLOUT));
+  return result;
+}
+
+/*
+ * Description: This function accepts a connection on the listening socket
+ * fd, like accept(2), but blocks only the RUNNING thread, like uthread_read,
+ * while there is none.
+ * Return value: Like accept(2): the descriptor of the accepted socket, or -1
+ * with errno set.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+
+  if (setNonBlocking(fd) < 0) {
+    return -1;
+  }
+  int result;
+  do {
+    result = accept(fd, addr, addrlen);
+  } while (result < 0 && retryIo(fd, EPOLLIN));
+  return result;
+}
+
 
 ////===============================  Helper Functions ==============================================
 
@@ -431,24 +896,56 @@ int uthread_get_quantums(int tid) {
 
 /** called if a quantum has ended (no blocking necessary)
  * (however, there might only be a main thread)
+ * Inside a critical section, or on an idle worker, the preemption waits for the end of it.
+ * A preempted thread resumes by returning from here, which restores the signal mask saved in
+ * context - so that is set to the current mask first, as for a thread that blocked or yielded.
  * */
-void timesUp(int sig) {
+void timesUp(int sig, siginfo_t *info, void *context) {
+
+  if (currentWorker() == nullptr) {
+    return;
+  }
+
+  // with SA_NODEFER a second signal may interrupt this handler anywhere, so the critical
+  // section is claimed before anything else, in one instruction - the second signal then only
+  // leaves its preemption pending
+  Thread *thread = currentThread();
+  if (thread == nullptr || __atomic_exchange_n(&thread->inCriticalSection, 1, __ATOMIC_SEQ_CST)) {
+    currentWorker()->preemptionPending = 1;
+    return;
+  }
+  enterCriticalSection();
+  preempt();
+
+  // running again - return to the uThread's code from the handler, with the mask the other
+  // threads left meanwhile instead of the one it was preempted with
+  leaveCriticalSection();
+  sigprocmask(SIG_SETMASK, nullptr, &((ucontext_t *) context)->uc_sigmask);
+}
+
+/**
+ * Ends the quantum of the running thread, in a critical section.
+ * A running thread another worker blocked or terminated is not ready anymore.
+ */
+void preempt() {
 
-  // if there are other threads waiting
-  if (readyThreads.front() != nullptr) {
-    // save the program before jump (with 1 to save signal mask)
+  Worker *worker = currentWorker();
+  Thread *thread = worker->running;
 
-    int retVal = sigsetjmp(running_thread->tEnv, 1);
+  // threads waiting for descriptors or timers aren't left waiting just because others keep
+  // running
+  pollIo(0);
+  expireTimers();
 
-    // if we have arrived here after a jump, - return from the function
-    // and continue executing the uThread's code.
-    if (retVal == POST_JUMP) { return; }
+  // if there are other threads waiting - here, or on another worker
+  if (thread->getStatus() == running && (!worker->scheduler->empty() || steal(worker))) {
 
     // change this thread's status to ready
-    running_thread->setStatus(ready);
+    thread->setStatus(ready);
 
-    //append to ready
-    readyThreads.push_back(running_thread);
+    // charge it for the quantum, and append to ready
+    worker->scheduler->stopped(thread);
+    enqueue(worker, thread);
 
   }
   // go to next thread
@@ -458,66 +955,407 @@ void timesUp(int sig) {
 /** switches to next thread
  *
  * this function should be called AFTER running has been placed in its desired queue
- * (READY, BLOCKED, or even terminated)
+ * (READY, BLOCKED, or even terminated), in a critical section. It returns when the thread
+ * runs again, still in the critical section - maybe on another worker.
+ * If no thread is ready, here or on another worker, the running thread goes on if it can,
+ * and the worker idles otherwise.
  * */
 void goToNextThread() {
 
-  // increment global timer
-  totalQuantumsRunning++;
+  Worker *worker = currentWorker();
+  Thread *previous = worker->running;
+
+  // free a thread that terminated itself, unless we are still on its stack
+  reapZombie(worker);
+  if (previous->getStatus() == terminated) {
+    worker->zombie = previous;
+  }
+
+  // the running thread is done with its quantum, whatever the reason
+  worker->scheduler->stopped(previous);
+
+  // take the next ready thread, by the policy, to running - maybe the running one again
+  Thread *next = takeReady(worker);
+  if (next == nullptr && steal(worker)) {
+    next = takeReady(worker);
+  }
 
   // check and see if there are ready threads
-  if (readyThreads.front() == nullptr) {
-    // increment main thread's timer
-    running_thread->incrementQuantumRunTime();
+  if (next == nullptr) {
+
+    if (previous->getStatus() == running) {
+      // increment global timer, and the running thread's
+      totalQuantumsRunning++;
+      previous->incrementQuantumRunTime();
+      worker->scheduler->started(previous);
+      if (tickless) {
+        armTimer(worker);
+      }
+      worker->preemptionPending = 0;
+      return;
+    }
+
+    // nothing to run - until another thread, or worker, or descriptor, makes a thread ready
+    worker->switches++;
+    worker->running = nullptr;
+    armTimer(worker);
+    int savedErrno = errno;
+    switchContext(&previous->tContext, worker->idleContext);
+    errno = savedErrno;
     return;
   }
 
-  // pop top ready to running
-  running_thread = readyThreads.front();
-  readyThreads.pop_front();
+  startQuantum(worker, next);
+  if (next != previous) {
+    // errno is the kernel thread's, and this thread may continue on another one
+    int savedErrno = errno;
+    switchContext(&previous->tContext, next->tContext);
+    errno = savedErrno;
+  }
+}
+
+/**
+ * Run only in case of self block (not self terminate), in a critical section
+ * @return
+ */
+void selfBlockAdjustment() {
+
+  // get the next thread from running.
+  goToNextThread();
+
+  // this thread picks up from here once it returns to running
+  leaveCriticalSection();
+}
+
+/**
+ * Where every spawned thread starts: it is switched to inside a critical section, like any
+ * thread, and leaves it before running its function. A thread returning from its function
+ * terminates.
+ */
+void startThread() {
+
+  leaveCriticalSection();
+  currentThread()->getEntry()();
+  uthread_terminate(uthread_get_tid());
+}
+
+/**
+ * Handler of SIGSEGV, running on its own stack.
+ * A fault on the guard page of the running thread is a stack overflow: it is reported as a
+ * library error, and the process exits. Any other fault is none of ours - the default action
+ * is restored, and the fault recurs when the handler returns.
+ * Only async-signal-safe calls are made: the message is formatted by hand and written with
+ * write(), and the process leaves with _exit() without tearing the library down.
+ */
+void stackOverflow(int sig, siginfo_t *info, void *context) {
+
+  Worker *worker = currentWorker();
+  Thread *thread = (worker == nullptr) ? nullptr : worker->running;
+  if (thread != nullptr && thread->isGuardAddress(info->si_addr)) {
+    static const char prefix[] = "thread library error: Stack overflow in thread ";
+    char message[sizeof(prefix) + 16];
+    size_t length = sizeof(prefix) - 1;
+    memcpy(message, prefix, length);
+
+    // the tid's digits, reversed into place
+    char digits[12];
+    size_t count = 0;
+    unsigned int tid = (unsigned int) thread->getTid();
+    do {
+      digits[count++] = (char) ('0' + tid % 10);
+      tid /= 10;
+    } while (tid > 0);
+    while (count > 0) {
+      message[length++] = digits[--count];
+    }
+    message[length++] = '.';
+    message[length++] = '\n';
+
+    ssize_t ignored = write(STDERR_FILENO, message, length);
+    (void) ignored;
+    _exit(1);
+  }
+  signal(sig, SIG_DFL);
+}
+
+/**
+ * Removes a thread from the ready threads of its worker, if it is there - O(1) but for the
+ * heap of UTHREAD_POLICY_FAIR.
+ * @param toRemove the thread to remove
+ */
+void removeFromReady(Thread *toRemove) {
+  if (toRemove->readyWorker >= 0) {
+    workers[toRemove->readyWorker]->scheduler->remove(toRemove);
+    toRemove->readyWorker = -1;
+  }
+}
+
+/**
+ * Adds a thread that became ready to the ready threads of this worker. If the running thread
+ * was alone, with the timer stopped, its quantum starts now.
+ * @param thread the thread to add
+ */
+void makeReady(Thread *thread) {
+  Worker *worker = currentWorker();
+  enqueue(worker, thread);
+  if (!worker->timerArmed && worker->running != nullptr) {
+    armTimer(worker);
+  }
+}
+
+/**
+ * Adds a ready thread to the ready threads of worker.
+ */
+void enqueue(Worker *worker, Thread *thread) {
+  thread->readyWorker = worker->index;
+  worker->scheduler->enqueue(thread);
+}
+
+/**
+ * Removes the thread to run next from the ready threads of worker.
+ * @return the thread, nullptr if none is ready.
+ */
+Thread *takeReady(Worker *worker) {
+  Thread *thread = worker->scheduler->pickNext();
+  if (thread != nullptr) {
+    thread->readyWorker = -1;
+  }
+  return thread;
+}
+
+/**
+ * Moves the next ready thread of another worker, the first after thief that has one, to the
+ * ready threads of thief.
+ * @return true iff there was one.
+ */
+bool steal(Worker *thief) {
+  for (size_t i = 1; i < workers.size(); i++) {
+    Worker *victim = workers[(thief->index + i) % workers.size()];
+    Thread *thread = takeReady(victim);
+    if (thread != nullptr) {
+      enqueue(thief, thread);
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Makes thread the running thread of worker, in a new quantum. The switch is up to the caller.
+ */
+void startQuantum(Worker *worker, Thread *thread) {
+
+  // increment global timer
+  totalQuantumsRunning++;
+
+  worker->switches++;
+  worker->running = thread;
+  worker->scheduler->started(thread);
 
   // set the thread status to running
-  running_thread->setStatus(running);
+  thread->setStatus(running);
 
   // increment running thread's timer
-  running_thread->incrementQuantumRunTime();
+  thread->incrementQuantumRunTime();
+
+  // resetting timer, to the quantum of the thread - a preemption still pending is for the
+  // quantum that ended
+  armTimer(worker);
+  worker->preemptionPending = 0;
+}
 
-  // resetting timer
-  if (setitimer(ITIMER_VIRTUAL, &timer, nullptr) < 0) {
-    print_error(SYS_ERR, "setitimer system error.");
+/**
+ * Starts a quantum of the running thread of worker. Stops the timer instead if the worker is
+ * idle, or in tickless mode if no other thread is ready, or waiting for a descriptor or a
+ * timer, as nothing could preempt it anyway.
+ */
+void armTimer(Worker *worker) {
+
+  if (worker->running == nullptr ||
+      (tickless && worker->scheduler->empty() && ioPoller.empty() && timerWheel.empty())) {
+    if (worker->timerArmed) {
+      struct itimerval stopped{};
+      setTimer(worker, stopped);
+      worker->timerArmed = false;
+    }
+    return;
   }
-  siglongjmp(running_thread->tEnv, POST_JUMP);
+  setTimer(worker, quantumOf(worker->running));
+  worker->timerArmed = true;
 }
 
 /**
- * Run only in case of self block (not self terminate)
- * @return
+ * Sets the quantum timer of worker: its own timer in M:N mode, the process's virtual timer
+ * otherwise.
  */
-void selfBlockAdjustment() {
+void setTimer(Worker *worker, const struct itimerval &value) {
 
-  // unblock signals and ignored pending because we are making scheduling decision anyway.
-  unblockSignalsAndIgnorePending();
+  if (!multiWorker) {
+    if (setitimer(ITIMER_VIRTUAL, &value, nullptr) < 0) {
+      print_error(SYS_ERR, "setitimer system error.");
+    }
+    return;
+  }
+  struct itimerspec spec;
+  spec.it_value.tv_sec = value.it_value.tv_sec;
+  spec.it_value.tv_nsec = value.it_value.tv_usec * 1000;
+  spec.it_interval.tv_sec = value.it_interval.tv_sec;
+  spec.it_interval.tv_nsec = value.it_interval.tv_usec * 1000;
+  if (timer_settime(worker->timer, 0, &spec, nullptr) < 0) {
+    print_error(SYS_ERR, "timer_settime system error.");
+  }
+}
+
+//// ------------------------  workers -------------------------------------------------------------
+
+/**
+ * @return the worker of the calling kernel thread, nullptr if it isn't one.
+ * Not inlined, so it is read again after every call that may switch threads: a uthread may
+ * continue on another worker.
+ */
+__attribute__((noinline)) Worker *currentWorker() {
+  return thisWorker;
+}
+
+/**
+ * @return the calling uthread. Outside of a critical section it may be preempted and moved to
+ * another worker at any moment, so the running thread of its worker is read like a seqlock:
+ * again if it has been on another worker, or its worker switched threads, meanwhile.
+ * With a single worker, it is simply the running thread.
+ */
+Thread *currentThread() {
+  if (!multiWorker) {
+    return workers[0]->running;
+  }
+  while (true) {
+    Worker *worker = currentWorker();
+    unsigned long switches = worker->switches;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    Thread *thread = worker->running;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (currentWorker() == worker && worker->switches == switches) {
+      return thread;
+    }
+  }
+}
 
-  // save the program before jump
-  int retVal = sigsetjmp(running_thread->tEnv, 1);
+/**
+ * @return the worker running thread, nullptr if none is.
+ */
+Worker *workerRunning(Thread *thread) {
+  for (Worker *worker : workers) {
+    if (worker->running == thread) {
+      return worker;
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Makes the worker running thread - another worker, which it blocked or terminated - stop
+ * running it: its timer handler preempts it, and finds it isn't running anymore.
+ */
+void stopRunning(Thread *thread) {
+  Worker *worker = workerRunning(thread);
+  if (worker != nullptr && worker != currentWorker()) {
+    pthread_kill(worker->thread, SIGVTALRM);
+  }
+}
+
+/**
+ * What a worker runs while it has no uthread to run, with the library locked: it waits for a
+ * ready thread - its own or another worker's - and runs it until the worker runs out again.
+ * Threads waiting for descriptors and timers become ready here.
+ * @param worker the worker - the idle loop stays on it
+ */
+void idleLoop(Worker *worker) {
+
+  while (true) {
+    reapZombie(worker);
+    Thread *next = takeReady(worker);
+    if (next == nullptr && steal(worker)) {
+      next = takeReady(worker);
+    }
+    if (next != nullptr) {
+      startQuantum(worker, next);
+      switchContext(&worker->idleContext, next->tContext);
+      continue;
+    }
+    if (expireTimers() | pollIo(0)) {
+      continue;
+    }
+    idleWait();
+  }
+}
 
-  if (retVal == POST_JUMP) {
+/**
+ * Waits, on an idle worker, for something that may make a thread ready: a descriptor, a timer,
+ * or another worker. A single worker sleeps until the next timer - in epoll, if threads wait
+ * for descriptors - as nothing else could; several pause briefly, to look at each other.
+ */
+void idleWait() {
 
-    // this thread will pick up from here once it returns to running
+  int64_t untilTimer = nanosUntilNextTimer();
+  if (!multiWorker && !ioPoller.empty()) {
+    pollIo(untilTimer < 0 ? -1 : (int) ((untilTimer + 999999) / 1000000));
     return;
   }
-  // get the next thread from running.
-  goToNextThread();
+
+  int64_t nanos = IDLE_PAUSE_NSEC;
+  if (untilTimer >= 0 && (!multiWorker || untilTimer < nanos)) {
+    nanos = untilTimer;
+  }
+  struct timespec pause = {(time_t) (nanos / 1000000000), (long) (nanos % 1000000000)};
+  unlockLibrary();
+  nanosleep(&pause, nullptr);
+  lockLibrary();
+}
+
+/**
+ * Where the idle loop of the first worker starts, on a stack of its own, the first time it
+ * runs out of threads to run.
+ */
+void startIdle() {
+  idleLoop(currentWorker());
+}
+
+/**
+ * Where the other workers start, on their own kernel threads.
+ */
+void *startWorker(void *arg) {
+  auto worker = (Worker *) arg;
+  thisWorker = worker;
+  initWorkerSignals(worker);
+  lockLibrary();
+  idleLoop(worker);
+  return nullptr;
 }
 
-void removeFromReady(const Thread *toRemove) {
-  for (unsigned int i = 0; i < readyThreads.size(); ++i) {
-    if (readyThreads[i] == toRemove) {
-      readyThreads.erase(readyThreads.begin() + i);
+/**
+ * Takes the library lock, in M:N mode. Whoever holds it isn't preempted - a critical section
+ * or an idle loop - so waiting for it is short, and spins - unless its kernel thread is off the
+ * CPU, which it gets back by sched_yield().
+ */
+void lockLibrary() {
+  if (multiWorker) {
+    int spins = 0;
+    while (libraryLock.test_and_set(std::memory_order_acquire)) {
+      if (++spins < LOCK_SPINS) {
+        __builtin_ia32_pause();
+      } else {
+        spins = 0;
+        sched_yield();
+      }
     }
   }
 }
 
+void unlockLibrary() {
+  if (multiWorker) {
+    libraryLock.clear(std::memory_order_release);
+  }
+}
+
 //// ------------------------  dependencies --------------------------------------------------------
 
 /**
@@ -529,13 +1367,16 @@ void removeFromReady(const Thread *toRemove) {
  * @param tid - tid of thread whose dependants we wish to restore.
  */
 void reviveDependants(int tid) {
-  std::deque<Thread *> *dependants = threadList[tid]->getThreadDependants();
+  ThreadQueue *dependants = threadList[tid]->getThreadDependants();
 
   // if this thread has dependant threads waiting for termination:
   while (!dependants->empty()) {
 
-    // set waiting thread's status to not syncd
+    // set waiting thread's status to not syncd, with no time limit anymore
     dependants->front()->setSyncedTo(NOT_SYNCED);
+    if (dependants->front()->timeoutKind == syncTimeout) {
+      timerWheel.remove(dependants->front());
+    }
 
     // if this thread is not waiting for a RESUME call
     if (!dependants->front()->getIsWaitingToResume()) {
@@ -544,11 +1385,11 @@ void reviveDependants(int tid) {
       // change the thread's status
       dependants->front()->setStatus(ready);
       // append the thread to ready
-      readyThreads.push_back((dependants->front()));
+      makeReady(dependants->front());
     }
 
     // pop and continue to the next dependant
-    dependants->pop_front();
+    dependants->popFront();
   }
 }
 
@@ -571,41 +1412,327 @@ void clearSyncTo(int tid) {
     threadList[syncTo]->clearSyncDep(threadList[tid]);
   }
 }
+//// ------------------------  I/O -----------------------------------------------------------------
+
+/**
+ * Puts fd in non-blocking mode, so I/O on it fails with EAGAIN instead of blocking the worker.
+ * @return 0 on success, -1 with errno set otherwise.
+ */
+int setNonBlocking(int fd) {
+  int flags = fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return -1;
+  }
+  if (!(flags & O_NONBLOCK) && fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return -1;
+  }
+  return 0;
+}
+
+/**
+ * Called after I/O on fd failed: waits until fd is ready for events, if that is why it failed.
+ * @return true iff the I/O should be tried again - false leaves errno as the failure set it.
+ */
+bool retryIo(int fd, uint32_t events) {
+  if (errno == EINTR) {
+    return true;
+  }
+  if (errno != EAGAIN && errno != EWOULDBLOCK) {
+    return false;
+  }
+  return awaitIo(fd, events) == 0;
+}
+
+/**
+ * Blocks the running thread until fd is ready for events, and runs the others meanwhile.
+ * @return 0 once it is, -1 with errno set if fd can't be waited for - or as it is, if the
+ * caller isn't a uthread (before uthread_init, or on a kernel thread of its own).
+ */
+int awaitIo(int fd, uint32_t events) {
+
+  // with no worker there is no thread to block, nor others to run
+  if (currentWorker() == nullptr) {
+    return -1;
+  }
+
+  enterCriticalSection();
+  Thread *thread = currentWorker()->running;
+  int result = -1;
+  try {
+    result = ioPoller.wait(thread, fd, events);
+  } catch (std::exception &e) {
+    print_error(SYS_ERR, "Failed to allocate the waiters of a descriptor.");
+  }
+  if (result < 0) {
+    leaveCriticalSection();
+    return -1;
+  }
+
+  thread->setStatus(blocked);
+  selfBlockAdjustment();
+  return 0;
+}
+
+/**
+ * Makes a thread whose descriptor is ready, ready - unless it is waiting for a RESUME call.
+ */
+void wakeIo(Thread *thread) {
+  if (!thread->getIsWaitingToResume()) {
+    thread->setStatus(ready);
+    makeReady(thread);
+  }
+}
+
+/**
+ * Makes the threads waiting for descriptors that are ready, ready, in a critical section.
+ * @param timeoutMillis how long to wait for a descriptor to be ready, if threads are waiting
+ *        for any: 0 not to wait, -1 until one is
+ * @return true iff it made a thread ready.
+ */
+bool pollIo(int timeoutMillis) {
+  return ioPoller.poll(timeoutMillis, &wakeIo) > 0;
+}
+
+//// ------------------------  timers --------------------------------------------------------------
+
+/**
+ * @return the current tick of the timer wheel, counted from the monotonic clock.
+ */
+uint64_t currentTick() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return ((uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec) / TIMER_TICK_NSEC;
+}
+
+/**
+ * @return nanoseconds until the timer wheel has something to do, -1 if it is empty.
+ */
+int64_t nanosUntilNextTimer() {
+  if (timerWheel.empty()) {
+    return -1;
+  }
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  int64_t nanos = (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+  int64_t next = (int64_t) (timerWheel.nextTick() * TIMER_TICK_NSEC);
+  return (next > nanos) ? next - nanos : 0;
+}
+
+/**
+ * Puts a thread in the timer wheel, until usecs pass - rounded up to the next tick, so it
+ * waits at least that long.
+ * @param thread a thread not in the wheel
+ * @param usecs how long it waits
+ * @param kind what it waits for meanwhile
+ */
+void addTimer(Thread *thread, int usecs, TimeoutKind kind) {
+
+  // the wheel moves on to the current tick first, so the thread is placed from there
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  uint64_t nanos = (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+  timerWheel.advance(nanos / TIMER_TICK_NSEC, &wakeTimer);
+
+  thread->timeoutKind = kind;
+  timerWheel.add(thread, (nanos + (uint64_t) usecs * 1000 + TIMER_TICK_NSEC - 1) / TIMER_TICK_NSEC);
+}
+
+/**
+ * Wakes the threads whose time ran out, in a critical section.
+ * @return true iff there were any.
+ */
+bool expireTimers() {
+  return !timerWheel.empty() && timerWheel.advance(currentTick(), &wakeTimer) > 0;
+}
+
+/**
+ * Ends the wait of a thread whose time ran out: a sleep ends, a block is resumed, and a sync
+ * is given up. Unless it is waiting for a RESUME call, the thread is ready again.
+ */
+void wakeTimer(Thread *thread) {
+
+  switch (thread->timeoutKind) {
+    case blockTimeout:
+      resumeThread(thread);
+      return;
+    case syncTimeout:
+      // only this timer ends a sync - a block's, put on the thread meanwhile, doesn't
+      thread->syncTimedOut = true;
+      threadList[thread->getSyncedTo()]->clearSyncDep(thread);
+      thread->setSyncedTo(NOT_SYNCED);
+      break;
+    case sleeping:
+      break;
+  }
+  if (!thread->getIsWaitingToResume()) {
+    thread->setStatus(ready);
+    makeReady(thread);
+  }
+}
+
+/**
+ * Resumes a thread waiting for a RESUME call: it is ready again, unless it is still synced,
+ * waiting for a descriptor, or sleeping.
+ */
+void resumeThread(Thread *thread) {
+
+  thread->unblockThread();
+  if (thread->timeoutKind == blockTimeout) {
+    timerWheel.remove(thread);
+  }
+
+  bool asleep = timerWheel.contains(thread) && thread->timeoutKind == sleeping;
+  if (thread->getSyncedTo() == NOT_SYNCED && thread->ioFd < 0 && !asleep) {
+
+    if (workerRunning(thread) != nullptr) {
+      // blocked on another worker, which didn't stop running it yet - and now won't
+      thread->setStatus(running);
+    } else {
+      thread->setStatus(ready);
+
+      makeReady(thread);
+    }
+  }
+}
+
 //// ------------------------  naming --------------------------------------------------------------
 
-void initialiseMinHeap() {
+/**
+ * Sets the limit on threads and the order of tids from config, and makes room for the first
+ * threads, so neither the table nor the free tids grow before there are more than that.
+ * @param config the options given to uthread_init_config
+ */
+void initialiseTids(const uthread_config *config) {
+
+  tidOrder = config->tid_order;
+  maxThreads = (config->max_threads == 0) ? MAX_THREAD_NUM : config->max_threads;
+
+  size_t initialSize = (maxThreads > 0 && maxThreads < MAX_THREAD_NUM) ? maxThreads : MAX_THREAD_NUM;
+  threadList.reserve(initialSize);
+  freeTids.reserve(initialSize);
+  std::vector<int> heapStorage;
+  heapStorage.reserve(initialSize);
+  tidMinHeap = std::priority_queue<int, std::vector<int>, std::greater<int> >(
+      std::greater<int>(), std::move(heapStorage));
+}
+
+/**
+ * Takes a free tid: a terminated thread's, in tidOrder, or else a new slot at the end of the
+ * table. Every tid below the end of the table is either in use or free, so the smallest free
+ * tid is the top of the heap when there is one.
+ * @return the tid, or -1 if we are at the limit of threads.
+ * @throws std::bad_alloc if the table could not grow
+ */
+int allocateTid() {
 
-  for (int i = 0; i <= MAX_THREAD_NUM; ++i) // zero-indexed to add main as well.
-  {
-    tidMinHeap.push(i);
+  if (maxThreads >= 0 && liveThreads >= maxThreads) {
+    return -1;
+  }
+
+  int tid;
+  if (tidOrder == UTHREAD_TID_RECENT && !freeTids.empty()) {
+    tid = freeTids.back();
+    freeTids.pop_back();
+  } else if (tidOrder == UTHREAD_TID_LOWEST && !tidMinHeap.empty()) {
+    tid = tidMinHeap.top();
+    tidMinHeap.pop();
+  } else {
+    tid = (int) threadList.size();
+    threadList.push_back(nullptr);
   }
+  liveThreads++;
+  return tid;
+}
+
+/**
+ * Empties the slot of a terminated thread, and makes its tid free.
+ * @param tid the tid of the terminated thread
+ */
+void releaseTid(int tid) {
+
+  threadList[tid] = nullptr;
+  if (tidOrder == UTHREAD_TID_RECENT) {
+    freeTids.push_back(tid);
+  } else {
+    tidMinHeap.push(tid);
+  }
+  liveThreads--;
 }
 
 int isLegalTid(int tid) {
 
   // checks if this is an existing thread
-  return (tid < MAX_THREAD_NUM && threadList[tid] != nullptr);
+  return (tid >= 0 && tid < (int) threadList.size() && threadList[tid] != nullptr);
 }
 
 //// ------------------------  memory --------------------------------------------------------------
 
 void freeAllMemory() {
 
+  Worker *current = currentWorker();
+  Thread *running = (current == nullptr) ? nullptr : current->running;
+  for (Worker *worker : workers) {
+    reapZombie(worker);
+  }
   for (auto &threadObj : threadList) // zero-indexed to delete main as well.
   {
-    delete threadObj;
+    // the stack we are running on is released by exit() along with the process
+    if (threadObj == nullptr || threadObj != running || threadObj->getTid() == 0) {
+      delete threadObj;
+    }
+  }
+  threadPool.clear();
+  ioPoller.close();
+  timerWheel.clear();
+  for (Worker *worker : workers) {
+    delete worker->scheduler;
+    delete worker;
   }
+  workers.clear();
+  thisWorker = nullptr;
 }
 
 /**
- * Terminates a thread and reclaims its tid.
+ * Terminates a thread, returns it to the pool and reclaims its tid.
+ * A running thread - terminating itself, or on another worker - is still on its stack, so it
+ * is only released once its worker switched away from it, by reapZombie().
  * @param thread
  */
 void terminateThread(Thread *thread) {
   int tid = thread->getTid();
-  delete thread;
-  threadList[tid] = nullptr;
-  tidMinHeap.push(tid);
+  if (workerRunning(thread) != nullptr) {
+    thread->setStatus(terminated);
+    stopRunning(thread);
+  } else {
+    threadPool.release(thread);
+  }
+  releaseTid(tid);
+}
+
+/**
+ * Releases the thread that terminated on worker, if there is one and we are no longer on its
+ * stack.
+ */
+void reapZombie(Worker *worker) {
+  if (worker->zombie != nullptr && worker->zombie != worker->running) {
+    threadPool.release(worker->zombie);
+    worker->zombie = nullptr;
+  }
+}
+
+/**
+ * Ends the process, after releasing the library memory. In M:N mode the other workers may still
+ * be running on the stacks, so those are left to the kernel, and the process ends right away,
+ * without exit handlers - the standard streams are flushed.
+ * @param status the exit status
+ */
+void exitProcess(int status) {
+  if (multiWorker) {
+    fflush(nullptr);
+    _exit(status);
+  }
+  freeAllMemory();
+  exit(status);
 }
 
 //// ------------------------  errors --------------------------------------------------------------
@@ -618,54 +1745,55 @@ void print_error(int type, const std::string &message) {
   // print error message with prefix
   std::cerr << title << message << "\n";
 
-  // if error is a system error - quit with status 1
+  // if error is a system error - release memory and quit with status 1
   if (type == SYS_ERR) {
-
-    //release memory
-    freeAllMemory();
-
-    // exit
-    exit(1);
+    exitProcess(1);
   }
 }
 
-//// ------------------------  signal blocking------------------------------------------------------
+//// ------------------------  critical sections -------------------------------------------------
 
 /**
- * This method will block the signal of SIGVTALRM until unblock is called explicitly.
+ * Keeps the timer signal from switching threads until leaveCriticalSection() - without a
+ * system call: the signal still arrives, and only marks the preemption as pending. In M:N mode
+ * it also takes the library lock, and the running thread stops here if another worker blocked
+ * or terminated it meanwhile.
+ * Critical sections don't nest.
  */
-void blockSignals() {
+void enterCriticalSection() {
 
-  if (sigprocmask(SIG_BLOCK, &blockedSignalSet, NULL) < 0) {
-    print_error(SYS_ERR, "System failed to block signals.");
+  // the flag is the thread's, and moves along with it to another worker
+  Thread *thread = currentThread();
+  if (thread != nullptr) {
+    thread->inCriticalSection = 1;
   }
-}
-
-/**
- * This method will unblock the signal of SIGVTALRM if it already been blocked explicitly.
- */
-void unblockSignals() {
-
-  if (sigprocmask(SIG_UNBLOCK, &blockedSignalSet, NULL) < 0) {
-    print_error(SYS_ERR, "System failed to unblock signals.");
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  lockLibrary();
+  if (thread != nullptr && thread->getStatus() != running) {
+    goToNextThread();
   }
 }
 
 /**
- * This method will unblock the signal of SIGVTALRM if it already been blocked explicitly.
+ * Ends a critical section, and ends the quantum of the running thread if it ran out meanwhile.
  */
-void unblockSignalsAndIgnorePending() {
-
-  if (sigemptyset(&blockedSignalSet) < 0) {
-    print_error(SYS_ERR, "Couldn't empty blockSignalSet during unblocking & ignoring.");
-  }
-
-  if (sigaddset(&blockedSignalSet, SIGVTALRM) < 0) {
-    print_error(SYS_ERR, "Couldn't add signal to blockSignalSet during unblocking & ignoring.");
-  }
-
-  if (sigprocmask(SIG_UNBLOCK, &blockedSignalSet, NULL) < 0) {
-    print_error(SYS_ERR, "System failed to unblock signals.");
+void leaveCriticalSection() {
+
+  while (true) {
+    unlockLibrary();
+    Worker *worker = currentWorker();
+    Thread *thread = worker->running;
+    if (thread == nullptr) {
+      return;
+    }
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    thread->inCriticalSection = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (!worker->preemptionPending) {
+      return;
+    }
+    enterCriticalSection();
+    preempt();
   }
 }
 
@@ -673,18 +1801,46 @@ void unblockSignalsAndIgnorePending() {
 
 void initTimerHandler() {
 
-  sa.sa_handler = &timesUp; // Install timesUp() as the signal handler for SIGVTALRM.
+  sa.sa_sigaction = &timesUp; // Install timesUp() as the signal handler for SIGVTALRM.
+  // the handler may switch to another thread, which must not start with the signal blocked -
+  // critical sections keep a second signal from switching in the middle of the first
+  sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+  if (sigemptyset(&sa.sa_mask) < 0) {
+    print_error(SYS_ERR, "Couldn't empty the mask of the timer handler.");
+  }
   if (sigaction(SIGVTALRM, &sa, NULL) < 0) {
     print_error(SYS_ERR, "Failed to install sigaction handler.");
   }
-  if (sigemptyset(&blockedSignalSet) < 0) {
-    print_error(SYS_ERR, "Couldn't empty blockSignalSet during init");
+}
+
+void initOverflowHandler() {
+
+  struct sigaction segv{};
+  segv.sa_sigaction = &stackOverflow;
+  segv.sa_flags = SA_SIGINFO | SA_ONSTACK;
+  if (sigemptyset(&segv.sa_mask) < 0 || sigaddset(&segv.sa_mask, SIGVTALRM) < 0) {
+    print_error(SYS_ERR, "Couldn't set the mask of the overflow handler.");
   }
-  if (sigaddset(&blockedSignalSet, SIGVTALRM) < 0) {
-    print_error(SYS_ERR, "Couldn't add signal to blockSignalSet during init");
+  if (sigaction(SIGSEGV, &segv, NULL) < 0) {
+    print_error(SYS_ERR, "Failed to install the overflow handler.");
   }
 }
 
+/**
+ * @return the timer of one quantum of thread: its own length, or the library's.
+ */
+struct itimerval quantumOf(Thread *thread) {
+
+  int usecs = thread->getQuantumUsecs();
+  if (usecs == 0) {
+    return timer;
+  }
+  struct itimerval quantum;
+  quantum.it_value.tv_sec = quantum.it_interval.tv_sec = usecs / SEC_IN_MICROSEC;
+  quantum.it_value.tv_usec = quantum.it_interval.tv_usec = usecs % SEC_IN_MICROSEC;
+  return quantum;
+}
+
 void initQuant(int quantum_usecs) {
 
   // Configure the timer to expire every quantum.*/
@@ -693,6 +1849,67 @@ void initQuant(int quantum_usecs) {
   // first time interval, uSec part
 }
 
+/**
+ * Allocates worker number index, and adds it to the workers. The first worker gets a stack for
+ * its idle loop - the others run it on the stacks of their kernel threads.
+ * @return the worker.
+ */
+Worker *initWorker(int index) {
+
+  Worker *worker = nullptr;
+  try {
+    worker = new Worker();
+    worker->index = index;
+    worker->altStack.resize(ALT_STACK_SIZE);
+    if (index == 0) {
+      worker->idleStack.resize(IDLE_STACK_SIZE);
+      worker->idleContext = makeContext(worker->idleStack.data() + IDLE_STACK_SIZE, &startIdle);
+    }
+    workers.push_back(worker);
+  } catch (std::exception &e) {
+    delete worker;
+    print_error(SYS_ERR, "Failed to allocate a worker.");
+  }
+  return worker;
+}
+
+/**
+ * Sets up the signals of the calling kernel thread, as worker: the stack of the overflow
+ * handler, and in M:N mode the quantum timer, which counts the CPU time of this kernel thread
+ * only, and signals it only.
+ */
+void initWorkerSignals(Worker *worker) {
+
+  stack_t altStackDesc{};
+  altStackDesc.ss_sp = worker->altStack.data();
+  altStackDesc.ss_size = ALT_STACK_SIZE;
+  if (sigaltstack(&altStackDesc, nullptr) < 0) {
+    print_error(SYS_ERR, "Failed to install the alternate signal stack.");
+  }
+
+  if (multiWorker) {
+    struct sigevent event{};
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGVTALRM;
+    event.sigev_notify_thread_id = (pid_t) syscall(SYS_gettid);
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &worker->timer) < 0) {
+      print_error(SYS_ERR, "timer_create system error.");
+    }
+  }
+}
+
+/**
+ * Starts the kernel threads of workers 1 to count - 1.
+ */
+void startWorkers(int count) {
+
+  for (int i = 1; i < count; i++) {
+    if (pthread_create(&workers[i]->thread, nullptr, &startWorker, workers[i]) != 0) {
+      print_error(SYS_ERR, "pthread_create system error.");
+    }
+  }
+}
+
 int spawnMainThread() {
 
   // spawn main thread (tid=0)
@@ -6,9 +6,58 @@
  * Author: OS, os@cs.huji.ac.il
  */
 
+#include <sys/types.h>
+#include <sys/socket.h>
+
 #define MAX_THREAD_NUM 100 /* maximal number of threads */
 #define STACK_SIZE 4096 /* stack size per thread (in bytes) */
 
+/* Order in which the ids of terminated threads are given to new ones */
+typedef enum {
+  UTHREAD_TID_LOWEST = 0, /* the smallest free id, as uthread_spawn describes - O(log n) */
+  UTHREAD_TID_RECENT      /* the most recently freed id - O(1) */
+} uthread_tid_order;
+
+/* Scheduling policies */
+typedef enum {
+  UTHREAD_POLICY_RR = 0,  /* round robin: ready threads run in FIFO order */
+  UTHREAD_POLICY_PRIORITY,/* strict priority: the most urgent ready thread runs. Waiting
+                             threads age towards the top, so none starves */
+  UTHREAD_POLICY_FAIR     /* weighted fair queuing: the ready thread with the least virtual
+                             runtime (time run, divided by weight) runs */
+} uthread_policy;
+
+#define UTHREAD_PRIORITY_LEVELS 32  /* priorities are 0 (most urgent) .. 31 */
+#define UTHREAD_DEFAULT_PRIORITY 16 /* priority of a new thread */
+#define UTHREAD_DEFAULT_WEIGHT 1024 /* weight of a new thread */
+#define UTHREAD_DEFAULT_AGING 4     /* quantums a thread waits to move up one priority */
+
+/* Options of uthread_init_config. A zero-initialised config means uthread_init. */
+typedef struct {
+  int max_threads;              /* limit on concurrent threads, main included:
+                                   0 for MAX_THREAD_NUM, negative for no limit */
+  uthread_tid_order tid_order;
+  int unguarded_stacks;         /* nonzero to map stacks without guard pages - each guarded
+                                   stack takes 2 of the vm.max_map_count (65530) mappings
+                                   a process may have, so 100k threads need this */
+  uthread_policy policy;        /* how the next thread to run is chosen */
+  int aging_quantums;           /* UTHREAD_POLICY_PRIORITY: quantums after which the longest
+                                   waiting thread of a priority moves up one priority:
+                                   0 for UTHREAD_DEFAULT_AGING, negative for no aging */
+  int tickless;                 /* nonzero to stop the quantum timer while only one thread
+                                   is runnable - its quantum doesn't end until another
+                                   thread becomes ready */
+  int workers;                  /* kernel threads running the uthreads (M:N mode), each with
+                                   its own ready threads and quantum timer, taking ready
+                                   threads from the others when it runs out: 0 or 1 for
+                                   just the thread that called uthread_init_config */
+} uthread_config;
+
+/* Signal masks: the threads share one signal mask - that of the process, or in M:N mode that
+   of the kernel thread running them. A switch neither saves nor restores it, so a mask one
+   thread sets stays in effect for the threads that run after it, however they stopped.
+   SIGVTALRM drives the quantum timer, and must not be blocked. */
+
 /* External interface */
 
 
@@ -22,18 +71,38 @@
 */
 int uthread_init(int quantum_usecs);
 
+/*
+ * Description: This function initializes the thread library like
+ * uthread_init, with the options in config (see uthread_config). It is
+ * called instead of uthread_init, not in addition to it.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_init_config(int quantum_usecs, const uthread_config *config);
+
 /*
  * Description: This function creates a new thread, whose entry point is the
  * function f with the signature void f(void). The thread is added to the end
  * of the READY threads list. The uthread_spawn function should fail if it
  * would cause the number of concurrent threads to exceed the limit
- * (MAX_THREAD_NUM). Each thread should be allocated with a stack of size
- * STACK_SIZE bytes.
+ * (MAX_THREAD_NUM, unless set by uthread_init_config). Each thread should
+ * be allocated with a stack of size STACK_SIZE bytes.
  * Return value: On success, return the ID of the created thread.
  * On failure, return -1.
 */
 int uthread_spawn(void (*f)(void));
 
+/*
+ * Description: This function creates a new thread like uthread_spawn, but
+ * with a stack of stack_size bytes (rounded up to whole pages) instead of
+ * STACK_SIZE. Every stack sits above an inaccessible guard page, so a thread
+ * overflowing its stack is reported as a thread library error, and the
+ * process exits, instead of corrupting memory. It is an error to call this
+ * function with non-positive stack_size.
+ * Return value: On success, return the ID of the created thread.
+ * On failure, return -1.
+*/
+int uthread_spawn_stack(void (*f)(void), int stack_size);
+
 
 /*
  * Description: This function terminates the thread with ID tid and deletes
@@ -61,6 +130,17 @@ int uthread_terminate(int tid);
 int uthread_block(int tid);
 
 
+/*
+ * Description: This function blocks the thread with ID tid like
+ * uthread_block, for at most timeout_usecs micro-seconds: then it is resumed
+ * as if by uthread_resume, unless it was resumed before. A negative
+ * timeout_usecs means no time limit. A thread already waiting with a time
+ * limit (sleeping, or in uthread_sync_timeout) is blocked without one.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_block_timeout(int tid, int timeout_usecs);
+
+
 /*
  * Description: This function resumes a blocked thread with ID tid and moves
  * it to the READY state. Resuming a thread in a RUNNING or READY state
@@ -81,6 +161,37 @@ int uthread_resume(int tid);
 int uthread_sync(int tid);
 
 
+/*
+ * Description: This function blocks the RUNNING thread like uthread_sync,
+ * until thread with ID tid will terminate, or timeout_usecs micro-seconds
+ * pass - whichever comes first. A negative timeout_usecs means no time limit.
+ * Return value: 0 if thread tid terminated, 1 if the time ran out first.
+ * On failure, return -1.
+*/
+int uthread_sync_timeout(int tid, int timeout_usecs);
+
+
+/*
+ * Description: This function moves the RUNNING thread to the end of the
+ * READY threads list, and makes a scheduling decision, like the end of its
+ * quantum does. If no other thread is READY, the RUNNING thread continues
+ * in the same quantum.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_yield();
+
+
+/*
+ * Description: This function blocks the RUNNING thread for usecs
+ * micro-seconds (at least, and to the resolution of a millisecond), and
+ * makes a scheduling decision. If it is blocked by uthread_block meanwhile,
+ * it runs again only once resumed as well. It is an error to call this
+ * function with negative usecs.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_usecs(int usecs);
+
+
 /*
  * Description: This function returns the thread ID of the calling thread.
  * Return value: The ID of the calling thread.
@@ -111,5 +222,72 @@ int uthread_get_total_quantums();
 */
 int uthread_get_quantums(int tid);
 
+
+/*
+ * Description: This function sets the priority of the thread with ID tid,
+ * from 0 (most urgent) to UTHREAD_PRIORITY_LEVELS - 1. Under
+ * UTHREAD_POLICY_PRIORITY, a READY thread moves to the end of the threads
+ * of its new priority; the new priority takes effect in the next scheduling
+ * decision. Under other policies the priority is only kept. It is an error
+ * if no thread with ID tid exists, or if priority is out of range.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority);
+
+
+/*
+ * Description: This function sets the weight of the thread with ID tid.
+ * Under UTHREAD_POLICY_FAIR, threads get CPU time in proportion to their
+ * weights; UTHREAD_DEFAULT_WEIGHT is the weight of a new thread. Under other
+ * policies the weight is only kept. It is an error if no thread with ID tid
+ * exists, or if weight is non-positive.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_weight(int tid, int weight);
+
+
+/*
+ * Description: This function sets the length of the quanta of the thread
+ * with ID tid in micro-seconds, from its next quantum on. 0 sets it back to
+ * the quantum given to uthread_init. It is an error if no thread with ID tid
+ * exists, or if quantum_usecs is negative.
+ * Return value: On success, return 0. On failure, return -1.
+*/
+int uthread_set_quantum(int tid, int quantum_usecs);
+
+
+/*
+ * Description: This function reads up to count bytes from the descriptor fd
+ * into buf, like read(2), but blocks only the RUNNING thread: while fd has
+ * nothing to read, the thread is BLOCKED, and the other threads run. fd is
+ * put in non-blocking mode. If the thread is blocked by uthread_block
+ * meanwhile, it runs again only once resumed as well. Called before
+ * uthread_init, it doesn't block: it fails with EAGAIN, like read(2) on a
+ * non-blocking descriptor.
+ * Return value: Like read(2): the number of bytes read, 0 at end of file,
+ * or -1 with errno set.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+
+/*
+ * Description: This function writes up to count bytes from buf to the
+ * descriptor fd, like write(2), but blocks only the RUNNING thread, like
+ * uthread_read, while fd has no room for any of them.
+ * Return value: Like write(2): the number of bytes written, or -1 with
+ * errno set.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+
+/*
+ * Description: This function accepts a connection on the listening socket
+ * fd, like accept(2), but blocks only the RUNNING thread, like uthread_read,
+ * while there is none.
+ * Return value: Like accept(2): the descriptor of the accepted socket, or -1
+ * with errno set.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
 #endif
 